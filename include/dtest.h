@@ -6,8 +6,12 @@
 #pragma once
 
 #include <dtest_core/test.h>
+#include <dtest_core/perf_counters.h>
+#include <dtest_core/statistics.h>
 
 using Status = dtest::Test::Status;
+using Counter = dtest::Counter;
+using Complexity = dtest::Complexity;
 
 #define __dtest_concat(a,b) __dtest_concat2(a,b)    // force expand
 #define __dtest_concat2(a,b) a ## b                 // actually concatenate
@@ -65,6 +69,34 @@ using Status = dtest::Test::Status;
 #define dtest_send_msg(m) dtest::Context::instance()->sendUserMessage(dtest::Context::instance()->createUserMessage() << m)
 #define dtest_recv_msg(m) dtest::Context::instance()->getUserMessage() >> m
 
+#define dtest_send_to(id, m) dtest::Context::instance()->sendTo(id, dtest::Context::instance()->createPeerMessage() << m)
+#define dtest_recv_from(id, m) dtest::Context::instance()->recvFrom(id) >> m
+
+#define dtest_ref(x) dtest::Message::ref(x)
+
+#define dtest_set_items_processed(n) dtest::Context::instance()->setItemsProcessed(n)
+#define dtest_set_bytes_processed(n) dtest::Context::instance()->setBytesProcessed(n)
+
+#define dtest_input_size() dtest::Context::instance()->inputSize()
+#define dtest_thread_index() dtest::Context::instance()->threadIndex()
+
+#define dtest_time_op(...) dtest::Context::instance()->timeOp(__VA_ARGS__)
+
+#define dtest_barrier() dtest::Context::instance()->barrier()
+#define dtest_broadcast(x) dtest::Context::instance()->broadcast(x)
+#define dtest_gather(x) dtest::Context::instance()->gather(x)
+#define dtest_reduce(x, op) dtest::Context::instance()->reduce(x, op)
+
+////
+
+#include <dtest_core/distributed_performance_test.h>
+
+#ifdef DTEST_DISABLE_ALL
+#define dperf(...) __test__(dtest::DistributedPerformanceTest, __VA_ARGS__).disable()
+#else
+#define dperf(...) __test__(dtest::DistributedPerformanceTest, __VA_ARGS__)
+#endif
+
 ////
 
 #include <dtest_core/random.h>
@@ -76,3 +108,10 @@ using Status = dtest::Test::Status;
 #include <dtest_core/time_of.h>
 
 #define dtest_timeOf(code) dtest::timeOf(code)
+
+////
+
+#include <dtest_core/do_not_optimize.h>
+
+#define dtest_do_not_optimize(x) dtest::doNotOptimize(x)
+#define dtest_clobber_memory() dtest::clobberMemory()
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace dtest {
+
+// CPUs in a list such as "0-3,8,10-11"
+std::vector<int> parseCpuList(const std::string &list);
+
+// CPUs of a NUMA node. Empty if the node does not exist.
+std::vector<int> numaNodeCpus(int node);
+
+// NUMA node of a CPU, or -1 if it is unknown
+int numaNodeOf(int cpu);
+
+// CPUs the calling process may currently run on
+std::vector<int> currentCpus();
+
+// Restricts the calling process (and the processes it forks later) to the
+// given CPUs, or to the CPUs of numaNode if cpus is empty. Memory is bound to
+// numaNode unless it is negative. Throws std::runtime_error on failure.
+void setAffinity(const std::vector<int> &cpus, int numaNode = -1);
+
+// Restricts the calling thread to one CPU. Throws std::runtime_error on failure.
+void setThreadAffinity(int cpu);
+
+}  // end namespace dtest
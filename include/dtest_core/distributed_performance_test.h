@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <dtest_core/distributed_unit_test.h>
+#include <map>
+
+namespace dtest {
+
+class DistributedPerformanceTest : public DistributedUnitTest {
+
+protected:
+
+    // what one node (driver or worker) measured
+    struct NodeResult {
+        uint64_t bodyTime;
+        uint64_t baselineTime;
+        uint64_t itemsProcessed;
+        uint64_t bytesProcessed;
+    };
+
+    std::function<void()> _baseline;
+    std::function<void()> _workerBaseline;
+
+    uint64_t _baselineTime = 0;
+    int64_t _baselineStart = 0;
+    CounterValues _baselineCounters;
+
+    uint64_t _performanceMargin = 1e6;      // 1 ms
+
+    double _performanceMarginRatio = 0;
+
+    std::map<uint32_t, NodeResult> _nodeResults;
+
+    inline bool _hasBaseline() const {
+        return _baseline || _workerBaseline;
+    }
+
+    void _measure(const std::function<void()> &body, const std::function<void()> &baseline);
+
+    bool _timed() const override {
+        return true;
+    }
+
+    void _driverRun() override;
+
+    void _workerRun() override;
+
+    void _sendResults(Message &m) override;
+
+    void _recvResults(uint32_t id, Message &m) override;
+
+    void _joinResults(std::stringstream &s) override;
+
+    std::string _throughputReport(const NodeResult &r);
+
+    void _report(bool driver, std::stringstream &s) override;
+
+    void _trace(bool driver, std::vector<TraceEvent> &events) override;
+
+public:
+
+    inline DistributedPerformanceTest(
+        const std::string &name
+    ): DistributedUnitTest(name)
+    { }
+
+    inline DistributedPerformanceTest(
+        const std::string &module,
+        const std::string &name
+    ): DistributedUnitTest(module, name)
+    { }
+
+    DistributedPerformanceTest * copy() const override {
+        return new DistributedPerformanceTest(*this);
+    }
+
+    ~DistributedPerformanceTest() = default;
+
+    inline DistributedPerformanceTest & dependsOn(const std::string &dependency) {
+        DistributedUnitTest::dependsOn(dependency);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & dependsOn(const std::initializer_list<std::string> &dependencies) {
+        DistributedUnitTest::dependsOn(dependencies);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & onInit(const std::function<void()> &onInit) {
+        DistributedUnitTest::onInit(onInit);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & driver(const std::function<void()> &body) {
+        DistributedUnitTest::driver(body);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & worker(const std::function<void()> &body) {
+        DistributedUnitTest::worker(body);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & baseline(const std::function<void()> &baseline) {
+        _baseline = baseline;
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & workerBaseline(const std::function<void()> &baseline) {
+        _workerBaseline = baseline;
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & onComplete(const std::function<void()> &onComplete) {
+        DistributedUnitTest::onComplete(onComplete);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & timeoutNanos(uint64_t nanos) {
+        DistributedUnitTest::timeoutNanos(nanos);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & timeoutMicros(uint64_t micros) {
+        DistributedUnitTest::timeoutMicros(micros);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & timeoutMillis(uint64_t millis) {
+        DistributedUnitTest::timeoutMillis(millis);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & timeout(uint64_t seconds) {
+        DistributedUnitTest::timeout(seconds);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & performanceMarginNanos(uint64_t nanos) {
+        _performanceMargin = nanos;
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & performanceMarginMicros(uint64_t micros) {
+        return performanceMarginNanos(micros * 1000lu);
+    }
+
+    inline DistributedPerformanceTest & performanceMarginMillis(uint64_t millis) {
+        return performanceMarginNanos(millis * 1000000lu);
+    }
+
+    inline DistributedPerformanceTest & performanceMargin(uint64_t seconds) {
+        return performanceMarginNanos(seconds * 1000000000lu);
+    }
+
+    inline DistributedPerformanceTest & performanceMarginAsBaselineRatio(double fractionOfBaselineTime) {
+        _performanceMarginRatio = fractionOfBaselineTime;
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & expect(Status status) {
+        DistributedUnitTest::expect(status);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & memoryBytesLimit(size_t bytes) {
+        DistributedUnitTest::memoryBytesLimit(bytes);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & memoryBlocksLimit(size_t blocks) {
+        DistributedUnitTest::memoryBlocksLimit(blocks);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & disable() {
+        DistributedUnitTest::disable();
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & enable() {
+        DistributedUnitTest::enable();
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & ignoreMemoryLeak(bool val = true) {
+        DistributedUnitTest::ignoreMemoryLeak(val);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & inProcess(bool val = true) {
+        DistributedUnitTest::inProcess(val);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & input(const std::string &input) {
+        DistributedUnitTest::input(input);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & resourceSnapshotBodyOnly(bool val = true) {
+        DistributedUnitTest::resourceSnapshotBodyOnly(val);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & cpus(const std::initializer_list<int> &cpus) {
+        DistributedUnitTest::cpus(cpus);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & numaNode(int node) {
+        DistributedUnitTest::numaNode(node);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & perfCounters(bool val = true) {
+        DistributedUnitTest::perfCounters(val);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & workers(uint16_t numWorkers) {
+        DistributedUnitTest::workers(numWorkers);
+        return *this;
+    }
+
+    inline DistributedPerformanceTest & faultyNetwork(double chance = 0.9, uint64_t holeDurationMillis = 10) {
+        DistributedUnitTest::faultyNetwork(chance, holeDurationMillis);
+        return *this;
+    }
+};
+
+}  // end namespace dtest
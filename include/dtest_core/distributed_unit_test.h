@@ -16,6 +16,7 @@ protected:
     std::function<void()> _workerBody;
 
     uint64_t _workerBodyTime = 0;
+    int64_t _workerBodyStart = 0;
 
     bool _faultyNetwork = false;
     double _faultyNetworkChance = 1;
@@ -35,6 +36,8 @@ protected:
 
     void _report(bool driver, std::stringstream &s) override;
 
+    void _trace(bool driver, std::vector<TraceEvent> &events) override;
+
 public:
 
     inline DistributedUnitTest(
@@ -151,6 +154,21 @@ public:
         return *this;
     }
 
+    inline DistributedUnitTest & cpus(const std::initializer_list<int> &cpus) {
+        UnitTest::cpus(cpus);
+        return *this;
+    }
+
+    inline DistributedUnitTest & numaNode(int node) {
+        UnitTest::numaNode(node);
+        return *this;
+    }
+
+    inline DistributedUnitTest & perfCounters(bool val = true) {
+        UnitTest::perfCounters(val);
+        return *this;
+    }
+
     inline DistributedUnitTest & workers(uint16_t numWorkers) {
         _numWorkers = numWorkers;
         return *this;
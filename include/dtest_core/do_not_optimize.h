@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <type_traits>
+#include <atomic>
+
+namespace dtest {
+
+#if defined(__GNUC__) || defined(__clang__)
+
+// Makes the compiler assume value is read, so the computation producing it is
+// kept. The barriers emit no instructions, and are inlined even without
+// optimization so that they add no call to the code being measured.
+template <typename T>
+__attribute__((always_inline)) inline void doNotOptimize(const T &value) {
+    __asm__ __volatile__("" : : "r,m"(value) : "memory");
+}
+
+// Same, but the compiler also assumes value may be modified, so it cannot be
+// treated as a constant afterwards.
+template <typename T>
+__attribute__((always_inline)) inline typename std::enable_if<
+    std::is_trivially_copyable<T>::value && (sizeof(T) <= sizeof(void *))
+>::type doNotOptimize(T &value) {
+    __asm__ __volatile__("" : "+m,r"(value) : : "memory");
+}
+
+template <typename T>
+__attribute__((always_inline)) inline typename std::enable_if<
+    ! (std::is_trivially_copyable<T>::value && (sizeof(T) <= sizeof(void *)))
+>::type doNotOptimize(T &value) {
+    __asm__ __volatile__("" : "+m"(value) : : "memory");
+}
+
+// Makes the compiler assume all memory is read and written here, so pending
+// stores are not elided or moved across this point.
+__attribute__((always_inline)) inline void clobberMemory() {
+    __asm__ __volatile__("" : : : "memory");
+}
+
+#else
+
+template <typename T>
+inline void doNotOptimize(const T &value) {
+    (void) *reinterpret_cast<const volatile char *>(&value);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+inline void clobberMemory() {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+#endif
+
+}  // end namespace dtest
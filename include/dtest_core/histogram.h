@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <dtest_core/message.h>
+
+namespace dtest {
+
+// High dynamic range histogram of latencies in nanoseconds. Values below
+// 256 ns are counted exactly, and larger ones in buckets no wider than 1/128
+// of their value, up to about 18 minutes. Once reset() has sized it, recording
+// never allocates, so it can be used inside measured code.
+class Histogram {
+private:
+    static const int _SUB_BITS = 8;
+    static const int _MAX_BITS = 40;
+
+    std::vector<uint64_t> _counts;
+    uint64_t _count = 0;
+    uint64_t _min = -1lu;
+    uint64_t _max = 0;
+    double _sum = 0;
+
+    static inline size_t _index(uint64_t value) {
+        if (value < (1lu << _SUB_BITS)) return value;
+        if (value >= (1lu << _MAX_BITS)) value = (1lu << _MAX_BITS) - 1;
+
+        int shift = 63 - __builtin_clzll(value) - _SUB_BITS + 1;
+        return ((size_t) shift << (_SUB_BITS - 1)) + (value >> shift);
+    }
+
+    // largest value that falls in the same bucket
+    static uint64_t _highestEquivalent(size_t index);
+
+public:
+
+    // sizes the histogram (if needed) and clears it
+    void reset();
+
+    // adds the values recorded in other
+    void add(const Histogram &other);
+
+    inline bool enabled() const {
+        return ! _counts.empty();
+    }
+
+    inline void record(uint64_t nanos) {
+        if (_counts.empty()) return;
+
+        ++_counts[_index(nanos)];
+        ++_count;
+        _sum += nanos;
+        if (nanos < _min) _min = nanos;
+        if (nanos > _max) _max = nanos;
+    }
+
+    inline uint64_t count() const {
+        return _count;
+    }
+
+    inline uint64_t min() const {
+        return _count > 0 ? _min : 0;
+    }
+
+    inline uint64_t max() const {
+        return _max;
+    }
+
+    inline double mean() const {
+        return _count > 0 ? _sum / _count : 0;
+    }
+
+    // value below or at which the given percentage of recorded values lie
+    uint64_t percentile(double percent) const;
+
+    friend class Message;
+};
+
+template <>
+inline Message & Message::operator<<<Histogram>(const Histogram &x) {
+    return *this << x._counts << x._count << x._min << x._max << x._sum;
+}
+
+template <>
+inline Message & Message::operator>><Histogram>(Histogram &x) {
+    return *this >> x._counts >> x._count >> x._min >> x._max >> x._sum;
+}
+
+}  // end namespace dtest
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace dtest {
+
+// Body times of earlier runs of performance tests. The history file is only
+// ever appended to, one line per run:
+//   <module>::<test> <tab> <unix time> <tab> <body time in ns>
+class History {
+private:
+    static std::string _path;
+    static std::unordered_map<std::string, std::vector<double>> _runs;
+
+public:
+    // loads the existing history, if any, and appends new runs to path
+    static void open(const std::string &path);
+
+    static inline bool enabled() {
+        return ! _path.empty();
+    }
+
+    // body times of a test, oldest first
+    static const std::vector<double> & runs(const std::string &test);
+
+    static void append(const std::string &test, double time);
+};
+
+}  // end namespace dtest
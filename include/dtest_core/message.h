@@ -9,10 +9,13 @@
 #include <cstring>
 #include <cstdlib>
 #include <dtest_core/socket.h>
+#include <dtest_core/buffer.h>
 
 #include <string>
 #include <vector>
 #include <list>
+#include <array>
+#include <type_traits>
 
 namespace dtest {
 
@@ -21,27 +24,54 @@ private:
 
     static const size_t _DEFAULT_BUFFER_SIZE = 1024;
 
+    // payloads at least this large that are wrapped in ref() are referenced
+    // by the message rather than copied into it, and are only gathered into
+    // the socket on send()
+    static const size_t _ZERO_COPY_THRESHOLD = 4096;
+
+    struct _Reference {
+        size_t offset;      // position in the owned buffer the payload follows
+        const void *data;
+        size_t len;
+    };
+
     void *_allocBuf = nullptr;
     size_t _allocLen = 0;
     uint8_t *_buf = nullptr;
     bool _hasData = false;
 
+    std::vector<_Reference> _refs;
+    size_t _refLen = 0;
+    uint32_t _referencePayloads = 0;
+    uint32_t _copyPayloads = 0;
+
     void _enter();
 
     void _exit();
 
+    // buffers come from a per-thread pool backed by the untracked libc
+    // allocator, so the steady-state message path does not allocate
+
+    static void * _acquire(size_t &len);
+
+    static void * _resize(void *buf, size_t len);
+
+    static void _release(void *buf, size_t len);
+
     inline void _fit(size_t sz) {
         size_t len = _buf - (uint8_t *) _allocBuf;
         size_t rem = _allocLen - len;
         if (rem < sz) {
-            _allocLen += (sz < _DEFAULT_BUFFER_SIZE) ? _DEFAULT_BUFFER_SIZE : sz;
-            _allocBuf = realloc(_allocBuf, _allocLen);
+            _allocLen *= 2;
+            if (_allocLen < len + sz) _allocLen = len + sz;
+            _allocBuf = _resize(_allocBuf, _allocLen);
             _buf = (uint8_t *) _allocBuf + len;
         }
     }
 
     inline void _dispose() {
-        if (_allocBuf != nullptr) free(_allocBuf);
+        if (_allocBuf != nullptr) _release(_allocBuf, _allocLen);
+        std::vector<_Reference>().swap(_refs);
     }
 
     inline void _invalidate() {
@@ -49,6 +79,7 @@ private:
         _allocLen = 0;
         _buf = nullptr;
         _hasData = false;
+        _refLen = 0;
     }
 
     inline void _move(Message &rhs) {
@@ -56,21 +87,103 @@ private:
         _allocLen = rhs._allocLen;
         _buf = rhs._buf;
         _hasData = rhs._hasData;
+        _refs = std::move(rhs._refs);
+        _refLen = rhs._refLen;
     }
 
+    void _copyFlattened(const Message &rhs);
+
     inline void _copy(const Message &rhs) {
-        _allocBuf = malloc(rhs._allocLen);
-        memcpy(_allocBuf, rhs._allocBuf, rhs._allocLen);
+        if (! rhs._refs.empty()) {
+            _copyFlattened(rhs);
+            return;
+        }
+
         _allocLen = rhs._allocLen;
+        _allocBuf = _acquire(_allocLen);
+        memcpy(_allocBuf, rhs._allocBuf, rhs._allocLen);
         _buf = (uint8_t *) _allocBuf + (rhs._buf - (uint8_t *) rhs._allocBuf);
         _hasData = rhs._hasData;
+        _refLen = 0;
+    }
+
+    // std::vector<bool> is packed and has no data()
+    template <typename T>
+    using _isBulk = std::integral_constant<
+        bool,
+        std::is_trivially_copyable<T>::value && ! std::is_same<T, bool>::value
+    >;
+
+    inline void _putPayload(const void *data, size_t len) {
+        if (_referencePayloads > 0 && _copyPayloads == 0) putReference(data, len);
+        else put(data, len);
+    }
+
+    template <typename T>
+    inline void _putElements(const T *x, size_t n, std::true_type) {
+        _putPayload(x, n * sizeof(T));
+    }
+
+    template <typename T>
+    inline void _putElements(const T *x, size_t n, std::false_type) {
+        for (size_t i = 0; i < n; ++i) operator<<(x[i]);
+    }
+
+    template <typename T>
+    inline void _getElements(T *x, size_t n, std::true_type) {
+        get(x, n * sizeof(T));
+    }
+
+    template <typename T>
+    inline void _getElements(T *x, size_t n, std::false_type) {
+        for (size_t i = 0; i < n; ++i) operator>>(x[i]);
+    }
+
+    template <typename T>
+    inline void _putVector(const std::vector<T> &x, std::true_type bulk) {
+        _putElements(x.data(), x.size(), bulk);
+    }
+
+    template <typename T>
+    inline void _putVector(const std::vector<T> &x, std::false_type) {
+        for (const auto & xx : x) operator<<(xx);
+    }
+
+    template <typename T>
+    inline void _getVector(std::vector<T> &x, std::true_type bulk) {
+        _getElements(x.data(), x.size(), bulk);
+    }
+
+    template <typename T>
+    inline void _getVector(std::vector<T> &x, std::false_type) {
+        for (size_t i = 0; i < x.size(); ++i) {
+            T xx;
+            operator>>(xx);
+            x[i] = std::move(xx);
+        }
     }
 
 public:
 
+    template <typename T>
+    struct Reference {
+        const T &value;
+    };
+
+    // Wraps a string, Buffer, or vector or array of trivially copyable
+    // elements so that operator<< references its payload instead of copying
+    // it. The payload must stay valid and unchanged until the message is sent.
+    template <typename T>
+    static inline Reference<T> ref(const T &x) {
+        return Reference<T>{ x };
+    }
+
+    template <typename T>
+    static void ref(const T &&) = delete;
+
     inline Message(size_t len = _DEFAULT_BUFFER_SIZE) {
-        _allocBuf = malloc(len);
         _allocLen = len;
+        _allocBuf = _acquire(_allocLen);
         _buf = (uint8_t *) _allocBuf + sizeof(size_t);
     }
 
@@ -144,6 +257,33 @@ public:
         return *this;
     }
 
+    // Appends len bytes at data without copying them if the payload is large.
+    // The memory must stay valid and unchanged until the message is sent.
+    inline Message & putReference(const void *data, size_t len) {
+        if (len < _ZERO_COPY_THRESHOLD || _copyPayloads > 0) return put(data, len);
+
+        _enter();
+
+        _refs.push_back({ (size_t) (_buf - (uint8_t *) _allocBuf), data, len });
+        _refLen += len;
+
+        _exit();
+        return *this;
+    }
+
+    // LEB128
+    inline Message & putVarint(uint64_t x) {
+        uint8_t b[10];
+        size_t n = 0;
+        do {
+            b[n] = x & 0x7f;
+            x >>= 7;
+            if (x != 0) b[n] |= 0x80;
+            ++n;
+        } while (x != 0);
+        return put(b, n);
+    }
+
     template <typename T>
     inline Message & operator<<(const T &x) {
         _enter();
@@ -162,6 +302,18 @@ public:
         return data;
     }
 
+    inline uint64_t getVarint() {
+        uint64_t x = 0;
+        uint8_t b;
+        uint32_t shift = 0;
+        do {
+            b = *_buf++;
+            x |= (uint64_t) (b & 0x7f) << shift;
+            shift += 7;
+        } while (b & 0x80);
+        return x;
+    }
+
     template <typename T>
     inline Message & operator>>(T &x) {
         x = *((T *) _buf);
@@ -171,55 +323,126 @@ public:
 
     // specialized overloads
 
+    template <typename T>
+    inline Message & operator<<(const Reference<T> &x) {
+        ++_referencePayloads;
+        operator<<(x.value);
+        --_referencePayloads;
+        return *this;
+    }
+
     template <typename T>
     inline Message & operator<<(const std::vector<T> &x) {
-        operator<<<size_t>(x.size());
-        for (const auto & xx : x) operator<<<T>(xx);
+        putVarint(x.size());
+        _putVector(x, _isBulk<T>());
         return *this;
     }
 
     template <typename T>
     inline Message & operator>>(std::vector<T> &x) {
-        size_t sz; operator>><size_t>(sz);
-        x = std::vector<T>(sz);
-        for (size_t i = 0; i < sz; ++i) {
-            operator>><T>(x[i]);
-        }
+        x = std::vector<T>(getVarint());
+        _getVector(x, _isBulk<T>());
+        return *this;
+    }
+
+    template <typename T, size_t N>
+    inline Message & operator<<(const std::array<T, N> &x) {
+        _putElements(x.data(), N, std::is_trivially_copyable<T>());
+        return *this;
+    }
+
+    template <typename T, size_t N>
+    inline Message & operator>>(std::array<T, N> &x) {
+        _getElements(x.data(), N, std::is_trivially_copyable<T>());
         return *this;
     }
 
     template <typename T>
     inline Message & operator<<(const std::list<T> &x) {
-        operator<<<size_t>(x.size());
-        for (const auto & xx : x) operator<<<T>(xx);
+        putVarint(x.size());
+        for (const auto & xx : x) operator<<(xx);
         return *this;
     }
 
     template <typename T>
     inline Message & operator>>(std::list<T> &x) {
-        size_t sz; operator>><size_t>(sz);
+        size_t sz = getVarint();
         x = std::list<T>();
         for (size_t i = 0; i < sz; ++i) {
             T xx;
-            operator>><T>(xx);
+            operator>>(xx);
             x.push_back(std::move(xx));
         }
         return *this;
     }
+
+    // temporaries are gone by the time the message is sent, so their
+    // payloads are always copied, even within a ref()
+
+    template <typename T>
+    inline Message & operator<<(std::vector<T> &&x) {
+        ++_copyPayloads;
+        operator<<(static_cast<const std::vector<T> &>(x));
+        --_copyPayloads;
+        return *this;
+    }
+
+    template <typename T, size_t N>
+    inline Message & operator<<(std::array<T, N> &&x) {
+        ++_copyPayloads;
+        operator<<(static_cast<const std::array<T, N> &>(x));
+        --_copyPayloads;
+        return *this;
+    }
+
+    template <typename T>
+    inline Message & operator<<(std::list<T> &&x) {
+        ++_copyPayloads;
+        operator<<(static_cast<const std::list<T> &>(x));
+        --_copyPayloads;
+        return *this;
+    }
+
+    inline Message & operator<<(std::string &&x) {
+        putVarint(x.size());
+        return put(x.data(), x.size());
+    }
+
+    inline Message & operator<<(Buffer &&x) {
+        putVarint(x.size());
+        return put(x.data(), x.size());
+    }
 };
 
 // template specializations
 
 template <>
 inline Message & Message::operator<<<std::string>(const std::string &x) {
-    put(x.c_str(), x.size() + 1);
+    putVarint(x.size());
+    _putPayload(x.data(), x.size());
     return *this;
 }
 
 template <>
 inline Message & Message::operator>><std::string>(std::string &x) {
-    x = (const char *) _buf;
-    _buf += x.size() + 1;
+    size_t sz = getVarint();
+    x.assign((const char *) _buf, sz);
+    _buf += sz;
+    return *this;
+}
+
+template <>
+inline Message & Message::operator<<<Buffer>(const Buffer &x) {
+    putVarint(x.size());
+    _putPayload(x.data(), x.size());
+    return *this;
+}
+
+template <>
+inline Message & Message::operator>><Buffer>(Buffer &x) {
+    size_t sz = getVarint();
+    x = Buffer((const void *) _buf, sz);
+    _buf += sz;
     return *this;
 }
 
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+namespace dtest {
+
+enum class Counter {
+    CYCLES,
+    INSTRUCTIONS,
+    LLC_MISSES,
+    BRANCH_MISSES,
+    CONTEXT_SWITCHES,
+    PAGE_FAULTS,
+};
+
+// counts of one phase of a test. Counters that could not be read are -1.
+struct CounterValues {
+    static const int COUNT = 6;
+
+    int64_t value[COUNT] = { -1, -1, -1, -1, -1, -1 };
+
+    inline int64_t & operator[](Counter c) {
+        return value[(int) c];
+    }
+
+    inline int64_t operator[](Counter c) const {
+        return value[(int) c];
+    }
+
+    static const char * name(Counter c);
+};
+
+// Hardware and software counters of the calling thread (and the threads it
+// starts), through perf_event_open. The hardware counters are opened as one
+// group so that they cover the same instructions. Counters the kernel (or a
+// virtual machine) does not provide are skipped, as are all counters when
+// disabled.
+class PerfCounters {
+private:
+    int _fd[CounterValues::COUNT];
+
+    int _leader = -1;
+
+    void _open(Counter c, uint32_t type, uint64_t config, bool group);
+
+public:
+    PerfCounters(bool enabled = true);
+
+    PerfCounters(const PerfCounters &) = delete;
+
+    ~PerfCounters();
+
+    // resets and starts all counters
+    void start();
+
+    void stop();
+
+    // adds the counts since start() to values. Counters that are multiplexed
+    // with others are scaled to the full running time.
+    void addTo(CounterValues &values) const;
+};
+
+}  // end namespace dtest
@@ -6,27 +6,206 @@
 #pragma once
 
 #include <dtest_core/unit_test.h>
+#include <dtest_core/statistics.h>
+#include <dtest_core/do_not_optimize.h>
+#include <algorithm>
+#include <atomic>
+#include <pthread.h>
 
 namespace dtest {
 
+// Compares the time of a body with that of its baseline, which it has to beat
+// by an absolute margin, or (with a nonzero ratio) take at most that fraction
+// of. Returns the error of a body that is too slow, or an empty string.
+std::string checkPerformanceMargin(
+    uint64_t bodyTime,
+    uint64_t baselineTime,
+    uint64_t margin,
+    double marginRatio
+);
+
 class PerformanceTest : public UnitTest {
 
 protected:
 
+    // runs a body n times. Built from the concrete type of the body, so that
+    // each run is a direct (usually inlined) call rather than one through a
+    // std::function. The barrier keeps the compiler from merging or hoisting
+    // the work of separate runs once the call is inlined
+    using Loop = std::function<void(uint64_t)>;
+
+    template <typename Func>
+    static inline Loop _loop(const Func &func) {
+        return [func] (uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                func();
+                clobberMemory();
+            }
+        };
+    }
+
     std::function<void()> _baseline;
 
+    Loop _bodyLoop;
+    Loop _baselineLoop;
+
     uint64_t _baselineTime = 0;
+    int64_t _baselineStart = 0;
 
     uint64_t _performanceMargin = 1e6;      // 1 ms
 
     double _performanceMarginRatio = 0;
 
+    // sampling
+    uint32_t _samples = 1;
+    uint32_t _warmup = 0;
+    uint64_t _minSampleTime = 1e6;          // 1 ms
+    bool _hasMinSampleTime = false;
+    double _significance = 0.05;
+
+    uint64_t _bodyIterations = 0;
+    uint64_t _baselineIterations = 0;
+    std::vector<double> _bodySamples;
+    std::vector<double> _baselineSamples;
+    double _pValue = 1;
+
+    int64_t _samplingStart = 0;
+    uint64_t _samplingTime = 0;
+
+    // input size sweep
+    std::vector<uint64_t> _inputSizes;
+    bool _hasExpectedComplexity = false;
+    Complexity _expectedComplexity = Complexity::CONSTANT;
+
+    // how much better (as a ratio and as a difference of relative errors) a
+    // faster growing complexity has to fit the times than the expected one
+    static constexpr double _COMPLEXITY_RMS_RATIO = 1.5;
+    static constexpr double _COMPLEXITY_RMS_MARGIN = 0.05;
+
+    std::vector<double> _rangeBodyTimes;
+    std::vector<double> _rangeBaselineTimes;
+
+    // thread count sweep. Times are kept per thread count and sample, and
+    // per-thread times also per thread
+    std::vector<uint32_t> _threadCounts;
+    std::vector<std::pair<uint32_t, double>> _minSpeedups;
+
+    std::vector<double> _threadWallTimes;
+    std::vector<double> _threadTimes;
+    std::vector<double> _scalingTimes;
+    bool _threadsPinned = true;
+
+    // operations timed with dtest_time_op() on each thread count
+    std::vector<Histogram> _scalingLatencies;
+
+    // latency
+    bool _latency = false;
+    uint64_t _latencyOperations = 0;
+    std::vector<std::pair<double, uint64_t>> _maxPercentiles;
+
+    // throughput. The body's amounts are in _itemsProcessed and _bytesProcessed
+    uint64_t _baselineItemsProcessed = 0;
+    uint64_t _baselineBytesProcessed = 0;
+
+    double _minItemsPerSecond = 0;
+    double _minBytesPerSecond = 0;
+    double _minThroughputRatio = 0;
+
+    // history of earlier runs, for tests without a baseline
+    static const size_t _MIN_HISTORY = 5;
+
+    double _regressionTolerance = 0.05;
+
+    size_t _historyRuns = 0;
+    size_t _historyRegimeRuns = 0;
+    double _historyMedian = 0;
+    double _historyMad = 0;
+
+    // counters
+    CounterValues _baselineCounters;
+    std::vector<std::pair<Counter, double>> _maxCounterRatios;
+
+    // allocations. The body's are in _bodyAllocations
+    Allocations _baselineAllocations;
+
+    uint64_t _maxAllocationsPerIteration = (uint64_t) -1;
+    uint64_t _maxAllocatedBytesPerIteration = (uint64_t) -1;
+
     void _checkPerformance();
 
+    void _checkCounters();
+
+    void _checkThroughput();
+
+    std::string _throughputReport();
+
+    void _checkAllocations();
+
+    std::string _allocationReport();
+
+    void _checkHistory();
+
+    bool _judgedByHistory() const;
+
+    void _checkSampledPerformance();
+
+    bool _checkSampleCount();
+
+    void _warnIgnoredOptions();
+
+    void _sampledRun();
+
+    void _baselineRun();
+
+    void _checkLatency();
+
+    void _latencyRun();
+
+    static std::string _latencyReport(const Histogram &latencies);
+
+    void _checkRangePerformance();
+
+    void _rangeRun();
+
+    std::string _rangeReport(const std::vector<double> &times);
+
+    // one thread of a multi-threaded run of the body
+    struct ThreadRun {
+        const std::function<void()> *body;
+        uint32_t index;
+        int cpu;
+        std::atomic<uint32_t> *ready;
+        std::atomic<bool> *go;
+
+        pthread_t thread;
+        uint64_t start;
+        uint64_t end;
+        bool pinned;
+        Histogram latencies;
+    };
+
+    static void * _runThread(void *run);
+
+    static uint64_t _timeThreads(const std::function<void()> &body, std::vector<ThreadRun> &runs);
+
+    double _speedup(size_t i) const;
+
+    void _checkScaling();
+
+    void _threadsRun();
+
+    std::string _threadsReport();
+
+    bool _timed() const override {
+        return true;
+    }
+
     void _driverRun() override;
 
     void _report(bool driver, std::stringstream &s) override;
 
+    void _trace(bool driver, std::vector<TraceEvent> &events) override;
+
 public:
 
     inline PerformanceTest(
@@ -61,13 +240,17 @@ public:
         return *this;
     }
 
-    inline PerformanceTest & body(const std::function<void()> &body) {
+    template <typename Body>
+    inline PerformanceTest & body(const Body &body) {
         UnitTest::body(body);
+        _bodyLoop = _loop(body);
         return *this;
     }
 
-    inline PerformanceTest & baseline(const std::function<void()> &baseline) {
+    template <typename Baseline>
+    inline PerformanceTest & baseline(const Baseline &baseline) {
         _baseline = baseline;
+        _baselineLoop = _loop(baseline);
         return *this;
     }
 
@@ -118,6 +301,120 @@ public:
         return *this;
     }
 
+    inline PerformanceTest & samples(uint32_t n) {
+        _samples = n;
+        return *this;
+    }
+
+    inline PerformanceTest & warmup(uint32_t n) {
+        _warmup = n;
+        return *this;
+    }
+
+    inline PerformanceTest & minSampleTimeMicros(uint64_t micros) {
+        _minSampleTime = micros * 1000lu;
+        _hasMinSampleTime = true;
+        return *this;
+    }
+
+    inline PerformanceTest & minSampleTimeMillis(uint64_t millis) {
+        _minSampleTime = millis * 1000000lu;
+        _hasMinSampleTime = true;
+        return *this;
+    }
+
+    inline PerformanceTest & significance(double alpha) {
+        _significance = alpha;
+        return *this;
+    }
+
+    // runs the body (and baseline) for input sizes lo, lo * multiplier, ...
+    // up to hi, which the body gets through dtest_input_size()
+    inline PerformanceTest & range(uint64_t lo, uint64_t hi, uint64_t multiplier = 2) {
+        _inputSizes.clear();
+        for (uint64_t n = lo; n <= hi; n *= multiplier) {
+            _inputSizes.push_back(n);
+            if (n == 0 || multiplier < 2) break;
+        }
+        return *this;
+    }
+
+    inline PerformanceTest & expectComplexity(Complexity complexity) {
+        _hasExpectedComplexity = true;
+        _expectedComplexity = complexity;
+        return *this;
+    }
+
+    // runs the body once on each of the given numbers of threads at a time,
+    // pinned to separate CPUs where there are enough of them. Each thread gets
+    // its index through dtest_thread_index()
+    inline PerformanceTest & threads(const std::initializer_list<uint32_t> &counts) {
+        _threadCounts = counts;
+        std::sort(_threadCounts.begin(), _threadCounts.end());
+        _threadCounts.erase(std::unique(_threadCounts.begin(), _threadCounts.end()), _threadCounts.end());
+        return *this;
+    }
+
+    // requires the throughput on the given number of threads to be
+    // significantly at least speedup times the throughput on the smallest
+    // number of threads
+    inline PerformanceTest & minSpeedup(uint32_t threads, double speedup) {
+        _minSpeedups.push_back({ threads, speedup });
+        return *this;
+    }
+
+    // records the latency of every operation: every run of the body if
+    // operations > 0, otherwise every call to dtest_time_op() in the body
+    inline PerformanceTest & latency(uint64_t operations = 0) {
+        _latency = true;
+        _latencyOperations = operations;
+        return *this;
+    }
+
+    inline PerformanceTest & percentileLessThanNanos(double percentile, uint64_t nanos) {
+        _latency = true;
+        _maxPercentiles.push_back({ percentile, nanos });
+        return *this;
+    }
+
+    inline PerformanceTest & p50LessThanMicros(uint64_t micros) {
+        return percentileLessThanNanos(50, micros * 1000lu);
+    }
+
+    inline PerformanceTest & p99LessThanMicros(uint64_t micros) {
+        return percentileLessThanNanos(99, micros * 1000lu);
+    }
+
+    inline PerformanceTest & p999LessThanMicros(uint64_t micros) {
+        return percentileLessThanNanos(99.9, micros * 1000lu);
+    }
+
+    inline PerformanceTest & minItemsPerSecond(double rate) {
+        _minItemsPerSecond = rate;
+        return *this;
+    }
+
+    inline PerformanceTest & minBytesPerSecond(double rate) {
+        _minBytesPerSecond = rate;
+        return *this;
+    }
+
+    inline PerformanceTest & minThroughputAsBaselineRatio(double multipleOfBaselineThroughput) {
+        _minThroughputRatio = multipleOfBaselineThroughput;
+        return *this;
+    }
+
+    inline PerformanceTest & regressionTolerance(double fractionOfHistoricalTime) {
+        _regressionTolerance = fractionOfHistoricalTime;
+        return *this;
+    }
+
+    inline PerformanceTest & maxCounterRatio(Counter counter, double ratio) {
+        _perfCounters = true;
+        _maxCounterRatios.push_back({ counter, ratio });
+        return *this;
+    }
+
     inline PerformanceTest & expect(Status status) {
         UnitTest::expect(status);
         return *this;
@@ -162,6 +459,38 @@ public:
         UnitTest::resourceSnapshotBodyOnly(val);
         return *this;
     }
+
+    inline PerformanceTest & cpus(const std::initializer_list<int> &cpus) {
+        UnitTest::cpus(cpus);
+        return *this;
+    }
+
+    inline PerformanceTest & numaNode(int node) {
+        UnitTest::numaNode(node);
+        return *this;
+    }
+
+    inline PerformanceTest & perfCounters(bool val = true) {
+        UnitTest::perfCounters(val);
+        return *this;
+    }
+
+    inline PerformanceTest & profile(bool val = true) {
+        UnitTest::profile(val);
+        return *this;
+    }
+
+    // fails the test as too slow if one run of the body allocates more often
+    // than this
+    inline PerformanceTest & maxAllocationsPerIteration(uint64_t allocations) {
+        _maxAllocationsPerIteration = allocations;
+        return *this;
+    }
+
+    inline PerformanceTest & maxAllocatedBytesPerIteration(uint64_t bytes) {
+        _maxAllocatedBytesPerIteration = bytes;
+        return *this;
+    }
 };
 
 }  // end namespace dtest
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace dtest {
+
+// A sampling CPU profiler for the calling process. While running, SIGPROF
+// interrupts the process every 1/frequency seconds of CPU time (of all its
+// threads) and the interrupted call stack is recorded. Samples beyond the
+// capacity of the profiler are dropped.
+class Profiler {
+private:
+    static const int _MAX_FRAMES = 64;
+    static const size_t _MAX_SAMPLES = 1 << 14;
+
+    static void _onSample(int);
+
+public:
+
+    // prepares the process for sampling. Called once, before any sandbox.
+    static void initialize();
+
+    // starts (or resumes) sampling. Samples accumulate until collect().
+    static void start(int frequency = 1000);
+
+    static void stop();
+
+    // the samples taken so far as folded stacks, one "outer;...;inner count"
+    // line per distinct stack, as used for flame graphs. Clears the samples.
+    static std::string collect();
+};
+
+struct HotFrame {
+    std::string frame;
+    uint64_t samples;
+};
+
+// total number of samples in folded stacks
+uint64_t profileSamples(const std::string &folded);
+
+// frames of folded stacks with the most samples in which they were the
+// innermost frame, most first
+std::vector<HotFrame> hotFrames(const std::string &folded, size_t count);
+
+}  // end namespace dtest
@@ -37,6 +37,32 @@ struct ResourceSnapshot {
     } network;
 };
 
+// allocations made by a number of runs of a test function
+struct Allocations {
+    uint64_t count = 0;
+    uint64_t size = 0;
+    uint64_t runs = 0;
+
+    // adds the allocations of runs between two totals of Sandbox::allocated()
+    inline void add(
+        const ResourceSnapshot::Quantity &before,
+        const ResourceSnapshot::Quantity &after,
+        uint64_t n
+    ) {
+        count += after.count - before.count;
+        size += after.size - before.size;
+        runs += n;
+    }
+
+    inline double countPerRun() const {
+        return runs > 0 ? (double) count / runs : 0;
+    }
+
+    inline double sizePerRun() const {
+        return runs > 0 ? (double) size / runs : 0;
+    }
+};
+
 class Sandbox {
 
     friend class CallStack;
@@ -129,6 +155,15 @@ public:
 
     void resourceSnapshot(ResourceSnapshot &snapshot);
 
+    // memory allocated so far in the sandbox, to count the allocations of a
+    // stretch of code without a full snapshot
+    inline ResourceSnapshot::Quantity allocated() const {
+        ResourceSnapshot::Quantity q;
+        q.size = _memory._allocateSize;
+        q.count = _memory._allocateCount;
+        return q;
+    }
+
     inline std::string memoryReport() {
         return _memory.report();
     }
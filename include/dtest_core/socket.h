@@ -6,7 +6,10 @@
 #pragma once
 
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 #include <netinet/ip.h>
+#include <unistd.h>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -20,17 +23,42 @@ private:
 
     static const size_t _INITIAL_SYSCALL_SIZE = 64 * 1024;
     static const size_t _MAX_MTU = 8192;
+    static const size_t _MAX_EVENTS = 64;
 
     static size_t _MTU;
 
+    static bool _localTransport;
+
     static void _resizeMTU(size_t oldMTU);
 
     int _fd;
+    int _localFd = -1;
     sockaddr _addr;
     std::unordered_map<int, Socket *> _openConnections;
 
+    // event loop (listening sockets only)
+    int _epfd = -1;
+    pid_t _epfdOwner = 0;
+    std::vector<epoll_event> _events;
+    size_t _readyPos = 0;
+    size_t _readyCount = 0;
+
     void _fillAddr();
 
+    void _ensureEventLoop();
+
+    void _closeEventLoop();
+
+    void _watch(int fd);
+
+    void _unwatch(int fd);
+
+    void _closeConnection(int fd);
+
+    void _listenLocal(int maxWaitingQueueLength);
+
+    bool _connectLocal(const sockaddr &addr);
+
     inline Socket(int fd, const sockaddr &addr)
     : _fd(fd), _addr(addr)
     { }
@@ -59,11 +87,20 @@ public:
 
     inline Socket(Socket &&rhs)
     : _fd(rhs._fd),
+      _localFd(rhs._localFd),
       _addr(std::move(rhs._addr)),
-      _openConnections(std::move(rhs._openConnections))
+      _openConnections(std::move(rhs._openConnections)),
+      _epfd(rhs._epfd),
+      _epfdOwner(rhs._epfdOwner),
+      _events(std::move(rhs._events)),
+      _readyPos(rhs._readyPos),
+      _readyCount(rhs._readyCount)
     {
         rhs._fd = -1;
+        rhs._localFd = -1;
         rhs._openConnections.clear();
+        rhs._epfd = -1;
+        rhs._readyPos = rhs._readyCount = 0;
     }
 
     ~Socket() {
@@ -76,8 +113,14 @@ public:
         close();
 
         _fd = rhs._fd; rhs._fd = -1;
+        _localFd = rhs._localFd; rhs._localFd = -1;
         _addr = rhs._addr;
         _openConnections = std::move(rhs._openConnections); rhs._openConnections.clear();
+        _epfd = rhs._epfd; rhs._epfd = -1;
+        _epfdOwner = rhs._epfdOwner;
+        _events = std::move(rhs._events);
+        _readyPos = rhs._readyPos;
+        _readyCount = rhs._readyCount; rhs._readyPos = rhs._readyCount = 0;
 
         return *this;
     }
@@ -86,6 +129,10 @@ public:
         _fd = -1;
     }
 
+    inline bool valid() const {
+        return _fd != -1;
+    }
+
     inline bool operator==(const Socket &rhs) const {
         return _fd == rhs._fd;
     }
@@ -96,20 +143,41 @@ public:
 
     void send(void *data, size_t len);
 
+    // Sends the iovecs in order, gathering them in as few syscalls as
+    // possible. The iovecs are consumed as they are sent.
+    void sendv(iovec *iov, size_t count);
+
     size_t recv(void *data, size_t len, bool returnOnBlock = false);
 
+    // Whether a small message can be sent right away, without blocking until
+    // the receiver reads. Also true if the connection failed, so that the
+    // next send() reports it.
+    bool writable() const;
+
+    void setSendBufferSize(int bytes);
+
     void close();
 
     Socket accept();
 
-    Socket * pollOrAcceptOrTimeout();
+    void acceptPending();
+
+    Socket * pollOrAcceptOrTimeout(int timeoutMillis = 10);
 
     Socket & pollOrAccept();
 
     void dispose(Socket &sock);
 
+    void disposeClosed();
+
+    static inline void useLocalTransport(bool val) {
+        _localTransport = val;
+    }
+
     static sockaddr self_address_ipv4(uint16_t port);
 
+    static bool is_local_ipv4(const sockaddr &addr);
+
     static std::string ipv4_to_str(const sockaddr &addr);
 
     static sockaddr str_to_ipv4(const std::string &ip, uint16_t port);
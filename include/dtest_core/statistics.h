@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+namespace dtest {
+
+double median(std::vector<double> x);
+
+// median absolute deviation from the median
+double medianAbsoluteDeviation(const std::vector<double> &x);
+
+struct ConfidenceInterval {
+    double low;
+    double high;
+};
+
+// percentile bootstrap interval of the median. Resampling is seeded, so the
+// same samples always give the same interval.
+ConfidenceInterval bootstrapMedianInterval(
+    const std::vector<double> &x,
+    double confidence = 0.95,
+    int resamples = 1000
+);
+
+// one-sided Mann-Whitney U test. Returns the p-value of the hypothesis that
+// values of a tend to be smaller than values of b (normal approximation with
+// tie correction).
+double mannWhitneyLess(const std::vector<double> &a, const std::vector<double> &b);
+
+// the fewest samples on each side with which mannWhitneyLess() can give a
+// p-value below alpha, which takes every value of a to be below every value
+// of b
+size_t mannWhitneyMinSamples(double alpha);
+
+// one-sided sign test. Returns the p-value of the hypothesis that values of x
+// tend to be greater than threshold (exact binomial, values equal to the
+// threshold are left out).
+double signTestGreater(const std::vector<double> &x, double threshold);
+
+// the fewest samples with which signTestGreater() can give a p-value below
+// alpha, which takes every value to be greater than the threshold
+size_t signTestMinSamples(double alpha);
+
+// start of the last segment of x, after splitting it at every significant
+// shift in level (binary segmentation with a two-sided Mann-Whitney U test,
+// Bonferroni corrected over the candidate splits). Segments are at least
+// minSegment long. Returns 0 if x has no change point.
+size_t lastChangePoint(const std::vector<double> &x, double alpha = 0.01, size_t minSegment = 5);
+
+enum class Complexity {
+    CONSTANT,
+    LOGARITHMIC,
+    LINEAR,
+    N_LOG_N,
+    QUADRATIC,
+};
+
+const char * complexityName(Complexity c);
+
+struct ComplexityFit {
+    Complexity complexity;
+    double coefficient;
+    double rms;             // root mean square of the relative errors
+};
+
+// least squares fit of time = coefficient * f(n), minimizing errors relative
+// to the measured times
+ComplexityFit fitComplexity(
+    const std::vector<double> &n,
+    const std::vector<double> &time,
+    Complexity complexity
+);
+
+// the fit with the lowest error
+ComplexityFit bestComplexityFit(const std::vector<double> &n, const std::vector<double> &time);
+
+}  // end namespace dtest
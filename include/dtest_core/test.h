@@ -12,12 +12,19 @@
 #include <iostream>
 #include <string>
 #include <functional>
+#include <mutex>
+#include <chrono>
 #include <stdint.h>
 #include <dtest_core/socket.h>
 #include <unistd.h>
 #include <dtest_core/sandbox.h>
 #include <dtest_core/lazy.h>
 #include <dtest_core/message.h>
+#include <dtest_core/buffer.h>
+#include <dtest_core/trace.h>
+#include <dtest_core/histogram.h>
+#include <dtest_core/time_of.h>
+#include <dtest_core/do_not_optimize.h>
 #include <sstream>
 
 namespace dtest {
@@ -59,6 +66,25 @@ protected:
     std::string _detailedReport = "";
     std::vector<std::string> _childDetailedReport;
 
+    std::vector<TraceEvent> _traceEvents;
+
+    std::string _joinedReport = "";
+
+    uint64_t _itemsProcessed = 0;
+    uint64_t _bytesProcessed = 0;
+
+    uint64_t _inputSize = 0;
+
+    // index of the calling thread while a performance test runs its body on
+    // several threads
+    static thread_local uint32_t _threadIndex;
+
+    // histogram that dtest_time_op() records into on such a thread, instead
+    // of the test's own, which the threads would otherwise share
+    static thread_local Histogram *_threadLatencies;
+
+    Histogram _latencies;
+
     ResourceSnapshot _usedResources;
     std::list<std::string> _errors;
 
@@ -70,6 +96,11 @@ protected:
         return false;
     }
 
+    // whether the test is timed, and so has to run alone
+    virtual bool _timed() const {
+        return false;
+    }
+
     virtual void _driverRun() = 0;
 
     virtual void _workerRun() {
@@ -78,6 +109,26 @@ protected:
 
     virtual void _report(bool driver, std::stringstream &s) = 0;
 
+    virtual void _trace(bool driver, std::vector<TraceEvent> &events) {
+        // no events
+    }
+
+    // results that the driver and each worker send to the main driver
+    // process once their part of a distributed test is done
+    virtual void _sendResults(Message &m) {
+        // no results
+    }
+
+    virtual void _recvResults(uint32_t id, Message &m) {
+        // no results
+    }
+
+    // called on the main driver process once all results are in. Anything
+    // written to s is added to the driver's report.
+    virtual void _joinResults(std::stringstream &s) {
+        // nothing to join
+    }
+
 private:
 
     void _skip();
@@ -156,6 +207,10 @@ private:
 
     static uint16_t _defaultNumWorkers;
 
+    static uint32_t _maxConcurrentTests;
+
+    static std::string _traceFile;
+
 public:
 
     static void setGlobalModuleDependencies(
@@ -171,6 +226,16 @@ public:
         _logStatsToStderr = val;
     }
 
+    static inline void setMaxConcurrentTests(uint32_t n) {
+        _maxConcurrentTests = (n == 0) ? 1 : n;
+    }
+
+    // writes the spans of all tests, on the driver and on every worker, to
+    // path in Chrome trace-event format
+    static inline void setTraceFile(const std::string &path) {
+        _traceFile = path;
+    }
+
     static bool runAll(
         const std::vector<std::pair<std::string, std::string>> &config = {},
         const std::unordered_set<std::string> &modules = {},
@@ -212,8 +277,55 @@ private:
 
 protected: 
 
+    struct PeerMessage {
+        uint32_t src;
+        uint32_t tag;
+        Message message;
+    };
+
+    // collectives run over a tree of ranks rooted at the driver (rank 0)
+    static const uint32_t _TREE_FANOUT = 2;
+
+    static const uint32_t _POINT_TO_POINT_TAG = -1u;
+
     Test *_currentTest;
 
+    // worker ids of ranks 1..n
+    std::vector<uint32_t> _peerIds;
+    std::vector<sockaddr> _peerAddrs;
+
+    uint32_t _collectiveTag = 0;
+    std::list<PeerMessage> _peerMessages;
+
+    virtual uint32_t _rank() const = 0;
+
+    inline uint32_t _numRanks() const {
+        return _peerIds.size() + 1;
+    }
+
+    uint32_t _rankOf(uint32_t id) const;
+
+    virtual Message _createPeerMessage(uint32_t tag) = 0;
+
+    virtual void _sendToPeer(uint32_t rank, Message &message) = 0;
+
+    virtual void _waitForPeerEvent() = 0;
+
+    Message _recvFromPeer(uint32_t rank, uint32_t tag);
+
+    inline uint32_t _treeParent() const {
+        return (_rank() - 1) / _TREE_FANOUT;
+    }
+
+    inline uint32_t _treeChildrenBegin() const {
+        return _rank() * _TREE_FANOUT + 1;
+    }
+
+    inline uint32_t _treeChildrenEnd() const {
+        uint32_t end = (_rank() + 1) * _TREE_FANOUT + 1;
+        return end < _numRanks() ? end : _numRanks();
+    }
+
 public:
     virtual ~Context() = default;
 
@@ -223,6 +335,35 @@ public:
         sandbox().unlock();
     }
 
+    inline void setItemsProcessed(uint64_t n) {
+        _currentTest->_itemsProcessed = n;
+    }
+
+    inline void setBytesProcessed(uint64_t n) {
+        _currentTest->_bytesProcessed = n;
+    }
+
+    inline uint64_t inputSize() const {
+        return _currentTest->_inputSize;
+    }
+
+    inline uint32_t threadIndex() const {
+        return Test::_threadIndex;
+    }
+
+    template <typename Op>
+    inline void timeOp(const Op &op) {
+        uint64_t start = preciseClock();
+        clobberMemory();
+        op();
+        clobberMemory();
+        uint64_t time = preciseClock() - start;
+
+        auto latencies = Test::_threadLatencies;
+        if (latencies == nullptr) latencies = &_currentTest->_latencies;
+        latencies->record(time > timerOverhead() ? time - timerOverhead() : 0);
+    }
+
     virtual Message createUserMessage() = 0;
 
     virtual void sendUserMessage(Message &message) = 0;
@@ -242,6 +383,96 @@ public:
     uint16_t numWorkers() const {
         return _currentTest->_numWorkers;
     }
+
+    Message createPeerMessage() {
+        return _createPeerMessage(_POINT_TO_POINT_TAG);
+    }
+
+    void sendTo(uint32_t id, Message &message);
+
+    Message recvFrom(uint32_t id);
+
+    void barrier();
+
+    template <typename T>
+    void broadcast(T &x) {
+        uint32_t tag = _collectiveTag++;
+
+        if (_rank() != 0) {
+            Message m = _recvFromPeer(_treeParent(), tag);
+            m >> x;
+        }
+
+        for (uint32_t c = _treeChildrenBegin(); c < _treeChildrenEnd(); ++c) {
+            Message m = _createPeerMessage(tag);
+            m << x;
+            _sendToPeer(c, m);
+        }
+    }
+
+    template <typename T>
+    std::vector<T> gather(const T &x) {
+        uint32_t tag = _collectiveTag++;
+
+        std::vector<uint32_t> ranks;
+        std::vector<T> values;
+
+        if (_rank() != 0) {
+            ranks.push_back(_rank());
+            values.push_back(x);
+        }
+
+        for (uint32_t c = _treeChildrenBegin(); c < _treeChildrenEnd(); ++c) {
+            Message m = _recvFromPeer(c, tag);
+
+            std::vector<uint32_t> r;
+            std::vector<T> v;
+            m >> r >> v;
+
+            ranks.insert(ranks.end(), r.begin(), r.end());
+            for (auto &vv : v) values.push_back(std::move(vv));
+        }
+
+        if (_rank() != 0) {
+            Message m = _createPeerMessage(tag);
+            m << ranks << values;
+            _sendToPeer(_treeParent(), m);
+            return std::vector<T>();
+        }
+
+        std::vector<T> result(values.size());
+        for (size_t i = 0; i < values.size(); ++i) {
+            result[ranks[i] - 1] = std::move(values[i]);
+        }
+        return result;
+    }
+
+    template <typename T, typename Op>
+    T reduce(const T &x, Op op) {
+        uint32_t tag = _collectiveTag++;
+
+        T acc = x;
+        bool hasValue = _rank() != 0;
+
+        for (uint32_t c = _treeChildrenBegin(); c < _treeChildrenEnd(); ++c) {
+            Message m = _recvFromPeer(c, tag);
+
+            T v;
+            m >> v;
+
+            acc = hasValue ? op(acc, v) : v;
+            hasValue = true;
+        }
+
+        if (_rank() != 0) {
+            Message m = _createPeerMessage(tag);
+            m << acc;
+            _sendToPeer(_treeParent(), m);
+            return x;
+        }
+
+        return acc;
+    }
 };
 
 class DriverContext : public Context {
@@ -260,6 +491,12 @@ private:
         NOTIFY,
         TERMINATE,
         USER_MESSAGE,
+        PEER_MESSAGE,
+        DRIVER_FINISHED,
+        FETCH_TESTS,
+        FETCH_FILE,
+        HEARTBEAT,
+        CLOCK_SYNC,
     };
 
     struct WorkerHandle {
@@ -272,6 +509,8 @@ private:
         bool _done = false;
         Test::Status _status = Test::Status::PENDING;
         std::string _detailedReport = "";
+        std::vector<TraceEvent> _traceEvents;
+        Message _results;
 
         inline WorkerHandle()
         : _socket([] { return nullptr; })
@@ -313,34 +552,108 @@ private:
             return operator=(rhs);
         }
 
-        void run(const Test *test);
+        void run(
+            const Test *test,
+            const std::vector<uint32_t> &peerIds,
+            const std::vector<sockaddr> &peerAddrs
+        );
 
         void notify();
 
         void terminate();
     };
 
+    // a distributed test running concurrently with others, driven from its
+    // own runner process
+    struct ConcurrentRun {
+        Test *test = nullptr;
+        pid_t pid = 0;
+        int64_t start = 0;
+        bool driverDone = false;
+        std::unordered_map<uint32_t, WorkerHandle> workers;
+        std::list<uint32_t> spawnedWorkers;
+    };
+
     std::unordered_map<uint32_t, WorkerHandle> _workers;
     std::unordered_map<uint32_t, WorkerHandle> _allocatedWorkers;
+    std::unordered_map<uint32_t, ConcurrentRun> _runs;
+    std::unordered_set<uint32_t> _busyWorkers;
+    uint32_t _nextRunId = 0;
     std::list<Message> _userMessages;
     Socket _socket;
     Socket _superSocket;
 
     uint16_t _port = 0;
+    uint16_t _runnerPort = 0;
+
+    uint32_t _launchCount = 0;
+    std::string _launchCommand;
+    std::list<uint32_t> _launchedWorkers;
+
+    std::vector<std::string> _testFiles;
+    std::vector<std::string> _testFileHashes;
+    std::vector<Buffer> _testFileContents;
+
+    int _heartbeatInterval = 200;
+    int _heartbeatTimeout = 2000;
+
+    bool _pinWorkers = false;
+    std::unordered_map<uint32_t, std::chrono::steady_clock::time_point> _heartbeats;
+    std::chrono::steady_clock::time_point _lastWorkerCheck;
+    std::chrono::steady_clock::time_point _lastHeartbeatCheck;
+    std::unordered_set<uint32_t> _lostWorkers;
+    uint32_t _testSeq = 0;
+
+    // estimated offset of a worker's clock from the driver's, with its error
+    // bound, as of the last synchronization
+    struct ClockSync {
+        int64_t offset = 0;
+        int64_t error = 0;
+        int64_t time = 0;
+    };
+
+    std::unordered_map<uint32_t, ClockSync> _clockSyncs;
+
+    static const int _CLOCK_SYNC_SAMPLES = 8;
+    static const int64_t _CLOCK_SYNC_PERIOD = 10000000000l;    // 10 seconds
 
     sockaddr _address;
     sockaddr _superAddress;
 
     DriverContext() = default;
 
+    uint32_t _nextWorkerId() const;
+
     WorkerHandle _spawnWorker();
 
+    uint32_t _launchWorker();
+
+    void _launchWorkers();
+
     void _start();
 
+    void _stop();
+
+    void _loadTestFiles();
+
     uint32_t _waitForSuperEvent();
 
     uint32_t _waitForEvent();
 
+    void _checkWorkers();
+
+    void _checkHeartbeats();
+
+    void _workerLost(uint32_t id, const std::string &reason);
+
+    void _replaceLostWorkers();
+
+    void _awaitWorker(uint32_t id);
+
+    void _syncClock(uint32_t id);
+
+    WorkerHandle * _findAllocatedWorker(uint32_t id);
+
     std::list<uint32_t> _allocateWorkers(uint16_t n);
 
     void _deallocateWorkers(std::list<uint32_t> &spawnedWorkers);
@@ -349,6 +662,26 @@ private:
 
     void _join(Test *test);
 
+    bool _canLaunch(const Test *test) const;
+
+    void _launch(Test *test);
+
+    Test * _waitForConcurrentTest();
+
+    inline bool _hasConcurrentTests() const {
+        return ! _runs.empty();
+    }
+
+    uint32_t _rank() const override {
+        return 0;
+    }
+
+    Message _createPeerMessage(uint32_t tag) override;
+
+    void _sendToPeer(uint32_t rank, Message &message) override;
+
+    void _waitForPeerEvent() override;
+
 public:
     void setPort(uint16_t port) {
         _port = port;
@@ -360,6 +693,36 @@ public:
         _workers[id] = WorkerHandle(id);
     }
 
+    // Starts n workers for the whole run. Without a command they are forked
+    // locally. Otherwise each one is started with "sh -c <command>", where
+    // {id}, {driver} and {args} are replaced by the worker id, the driver
+    // address and the arguments a worker needs to join this driver.
+    void launchWorkers(uint32_t n, const std::string &command = "") {
+        _launchCount = n;
+        _launchCommand = command;
+    }
+
+    // Workers send a heartbeat every interval. A worker that stays silent for
+    // longer than the timeout fails its test and is dropped from the pool.
+    // A timeout of 0 disables the detection.
+    void setHeartbeatInterval(int millis) {
+        _heartbeatInterval = millis;
+    }
+
+    void setHeartbeatTimeout(int millis) {
+        _heartbeatTimeout = millis;
+    }
+
+    // pins each forked worker to a single CPU of the driver's CPU set
+    void pinWorkers(bool val) {
+        _pinWorkers = val;
+    }
+
+    // test files streamed to workers started with fetchTests()
+    void serveTests(const std::vector<std::string> &paths) {
+        _testFiles = paths;
+    }
+
     Message createUserMessage() override;
 
     void sendUserMessage(Message &message) override;
@@ -389,14 +752,39 @@ private:
     uint32_t _id = -1;
     uint32_t _notifyCount = 0;
     std::list<Message> _userMessages;
+    uint32_t _peerRank = 0;
+    std::unordered_map<uint32_t, Socket> _peerSockets;
     Socket _socket;
+    Socket _driverSocket;
+    Socket _superDriverSocket;
+    Socket _runnerSocket;
+    std::mutex _driverSocketMtx;
     std::unordered_map<std::string, Test *> _tests;
     bool _inTest = false;
+    int _heartbeatPipe = -1;
 
     void _start(uint32_t id);
 
+    void _startHeartbeat();
+
+    void _heartbeat(int pipeFd);
+
+    void _setHeartbeatTarget(const sockaddr *addr, uint32_t testSeq = 0);
+
     void _waitForEvent();
 
+    void _sendToDriver(Message &message);
+
+    uint32_t _rank() const override {
+        return _peerRank;
+    }
+
+    Message _createPeerMessage(uint32_t tag) override;
+
+    void _sendToPeer(uint32_t rank, Message &message) override;
+
+    void _waitForPeerEvent() override;
+
 public:
 
     Message createUserMessage() override;
@@ -413,6 +801,10 @@ public:
         return _id;
     }
 
+    // Downloads the driver's test files into cacheDir, reusing files of the
+    // same content from earlier runs. Returns the paths to load.
+    static std::vector<std::string> fetchTests(uint32_t id, const std::string &cacheDir);
+
     static Lazy<WorkerContext> instance;
 };
 
@@ -10,5 +10,17 @@
 
 namespace dtest
 {
+    // Time in nanoseconds from the CPU's time stamp counter, read between
+    // serializing fences, where the counter is invariant. The counter is
+    // calibrated against the steady clock on first use (or by
+    // calibratePreciseClock()). Without an invariant counter, this is the
+    // steady clock.
+    uint64_t preciseClock();
+
+    void calibratePreciseClock();
+
+    // time that timing an empty body takes, which timeOf() subtracts
+    uint64_t timerOverhead();
+
     uint64_t timeOf(const std::function<void()> &func);
 } // namespace dtest
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <string>
+#include <stdint.h>
+#include <dtest_core/message.h>
+
+namespace dtest {
+
+// A span of time spent on one node of a test. Nodes record spans on their own
+// clock; the driver shifts worker spans onto its own clock when it receives
+// them, and sets clockError to the error bound of that shift.
+struct TraceEvent {
+    std::string name;
+    uint32_t node;
+    int64_t start;
+    int64_t duration;
+    int64_t clockError;
+};
+
+// monotonic time in nanoseconds, used for all trace timestamps
+int64_t traceClock();
+
+template <>
+inline Message & Message::operator<<<TraceEvent>(const TraceEvent &x) {
+    return *this << x.name << x.node << x.start << x.duration;
+}
+
+template <>
+inline Message & Message::operator>><TraceEvent>(TraceEvent &x) {
+    return *this >> x.name >> x.node >> x.start >> x.duration;
+}
+
+}  // end namespace dtest
@@ -6,6 +6,8 @@
 #pragma once
 
 #include <dtest_core/test.h>
+#include <dtest_core/perf_counters.h>
+#include <dtest_core/profiler.h>
 
 namespace dtest {
 
@@ -32,11 +34,31 @@ protected:
     uint64_t _bodyTime = 0;
     uint64_t _completeTime = 0;
 
+    int64_t _initStart = 0;
+    int64_t _bodyStart = 0;
+    int64_t _completeStart = 0;
+
     bool _inProcessSandbox = false;
     bool _resourceSnapshotBodyOnly = false;
 
+    std::vector<int> _cpus;
+    int _numaNode = -1;
+
+    // counters (per run)
+    bool _perfCounters = false;
+    CounterValues _bodyCounters;
+
+    Allocations _bodyAllocations;
+
+    // profile of the body, as folded stacks
+    bool _profile = false;
+    std::string _profileStacks;
+    std::string _profileFile;
+
     virtual void _configure();
 
+    uint64_t _timeOf(const std::function<void()> &func, CounterValues &counters);
+
     void _checkMemoryLeak();
 
     void _checkTimeout(uint64_t time);
@@ -47,8 +69,16 @@ protected:
 
     std::string _memoryReport();
 
+    std::string _counterReport(const CounterValues &counters);
+
+    void _saveProfile();
+
+    std::string _profileReport();
+
     void _report(bool driver, std::stringstream &s) override;
 
+    void _trace(bool driver, std::vector<TraceEvent> &events) override;
+
 public:
 
     inline UnitTest(
@@ -154,6 +184,26 @@ public:
         _resourceSnapshotBodyOnly = val;
         return *this;
     }
+
+    inline UnitTest & cpus(const std::initializer_list<int> &cpus) {
+        _cpus = cpus;
+        return *this;
+    }
+
+    inline UnitTest & numaNode(int node) {
+        _numaNode = node;
+        return *this;
+    }
+
+    inline UnitTest & perfCounters(bool val = true) {
+        _perfCounters = val;
+        return *this;
+    }
+
+    inline UnitTest & profile(bool val = true) {
+        _profile = val;
+        return *this;
+    }
 };
 
 }  // end namespace dtest
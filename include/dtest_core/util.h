@@ -7,12 +7,19 @@
 
 #include <string>
 #include <sstream>
+#include <stdint.h>
 
 std::string formatDuration(double nanos);
 std::string formatDurationJSON(double nanos);
 
 std::string formatSize(size_t size);
 
+std::string formatRate(double perSecond, const std::string &unit, double base = 1000);
+std::string formatRateJSON(double perSecond, const std::string &unit, double base = 1000);
+
+// hex digest
+std::string sha256(const void *data, size_t len);
+
 std::string indent(const std::string &str, int spaces);
 
 std::string jsonify(const std::string &str);
@@ -27,38 +27,11 @@ TEST_DIR=$2
 #remove empty lines from sbin/workers
 sed -i '/^$/d' $DIR/workers
 
-for m in $(cat $DIR/workers) ; do
-    ssh -A $CLUSTER_USER@$m "sh -c 'mkdir -p $DTEST_HOME/tmp'" &
-done
-wait
-
-for m in $(cat $DIR/workers) ; do
-    scp -r $TEST_DIR $CLUSTER_USER@$m:$DTEST_HOME/tmp > /dev/null &
-done
-wait
-
-$ENV
-$EXEC --port $PORT --workers $(wc -l $DIR/workers | awk '{ print $1 }') $TEST_DIR &
-DRIVER=$!
-
-id=0
-WORKERS=()
-for m in $(cat $DIR/workers) ; do
-    let id=id+1
-    ssh -A $CLUSTER_USER@$m "sh -c '\
-        cd $DTEST_HOME ; \
-        $ENV \
-        nohup $EXEC --driver $(hostname):$PORT --worker-id $id tmp > /dev/null 2>&1 & \
-        echo \$! > tmp/pid \
-    '" &
-done
-
-wait $DRIVER
-
-for m in $(cat $DIR/workers) ; do
-    ssh -A $CLUSTER_USER@$m "sh -c '\
-        kill \$(cat $DTEST_HOME/tmp/pid) ; \
-        rm -rf $DTEST_HOME/tmp \
-    '" &
-done
-wait
+# the driver starts one worker per line of sbin/workers and streams the test
+# files to them, so nothing needs to be copied to the workers beforehand
+eval $ENV
+$EXEC \
+    --port $PORT \
+    --launch $(wc -l $DIR/workers | awk '{ print $1 }') \
+    --launch-cmd "ssh -A $CLUSTER_USER@\$(sed -n {id}p $DIR/workers) \"cd $DTEST_HOME ; $ENV $EXEC {args}\"" \
+    $TEST_DIR
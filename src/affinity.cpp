@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest_core/affinity.h>
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+using namespace dtest;
+
+std::vector<int> dtest::parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+
+    std::stringstream s(list);
+    std::string range;
+
+    while (std::getline(s, range, ',')) {
+        if (range.empty() || range == "\n") continue;
+
+        auto dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        }
+        catch (const std::logic_error &) {
+            throw std::runtime_error("Invalid CPU list '" + list + "'");
+        }
+    }
+
+    return cpus;
+}
+
+std::vector<int> dtest::numaNodeCpus(int node) {
+    std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (! f.good()) return { };
+
+    std::string list;
+    std::getline(f, list);
+    return parseCpuList(list);
+}
+
+int dtest::numaNodeOf(int cpu) {
+    std::ifstream f("/sys/devices/system/node/online");
+    if (! f.good()) return -1;
+
+    std::string list;
+    std::getline(f, list);
+
+    for (auto node : parseCpuList(list)) {
+        for (auto c : numaNodeCpus(node)) {
+            if (c == cpu) return node;
+        }
+    }
+
+    return -1;
+}
+
+std::vector<int> dtest::currentCpus() {
+    std::vector<int> cpus;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+void dtest::setAffinity(const std::vector<int> &cpus, int numaNode) {
+    auto allowed = cpus;
+
+    if (numaNode >= 0) {
+        if (numaNode >= (int) (sizeof(unsigned long) * 8)) {
+            throw std::runtime_error("Invalid NUMA node " + std::to_string(numaNode));
+        }
+
+        if (allowed.empty()) {
+            allowed = numaNodeCpus(numaNode);
+            if (allowed.empty()) {
+                throw std::runtime_error("NUMA node " + std::to_string(numaNode) + " has no CPUs");
+            }
+        }
+
+        unsigned long nodes = 1lu << numaNode;
+        if (syscall(SYS_set_mempolicy, MPOL_BIND, &nodes, sizeof(nodes) * 8) != 0) {
+            throw std::runtime_error(
+                "Failed to bind memory to NUMA node " + std::to_string(numaNode) + ". "
+                + strerror(errno)
+            );
+        }
+    }
+
+    if (allowed.empty()) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : allowed) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            throw std::runtime_error("Invalid CPU " + std::to_string(cpu));
+        }
+        CPU_SET(cpu, &set);
+    }
+
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        throw std::runtime_error(std::string("Failed to set CPU affinity. ") + strerror(errno));
+    }
+}
+
+void dtest::setThreadAffinity(int cpu) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        throw std::runtime_error("Invalid CPU " + std::to_string(cpu));
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        throw std::runtime_error(
+            "Failed to set CPU affinity of thread to CPU " + std::to_string(cpu) + ". " + strerror(err)
+        );
+    }
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest_core/distributed_performance_test.h>
+#include <dtest_core/performance_test.h>
+#include <dtest_core/util.h>
+#include <dtest_core/time_of.h>
+
+using namespace dtest;
+
+void DistributedPerformanceTest::_measure(
+    const std::function<void()> &body,
+    const std::function<void()> &baseline
+) {
+    auto opt = Sandbox::Options();
+    opt.fork(! _inProcessSandbox);
+    opt.input(_input);
+
+    auto finish = sandbox().run(
+        _timeout < 2000000000lu ? 2000000000lu : _timeout,
+        [this, &body, &baseline] {
+            _configure();
+
+            _status = Status::FAIL;
+
+            if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _initStart = traceClock();
+            _initTime = timeOf(_onInit);
+
+            // all nodes start each measured block together
+            Context::instance()->barrier();
+
+            if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _bodyStart = traceClock();
+            _bodyTime = _timeOf(body, _bodyCounters);
+            if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+
+            if (_hasBaseline()) {
+                Context::instance()->barrier();
+
+                _baselineStart = traceClock();
+                _baselineTime = _timeOf(baseline, _baselineCounters);
+            }
+
+            _completeStart = traceClock();
+            _completeTime = timeOf(_onComplete);
+            if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+
+            _status = Status::PASS;
+        },
+        [this] (Message &m) {
+            _checkMemoryLeak();
+            _checkTimeout(_bodyTime);
+
+            m << _status
+                << _usedResources
+                << _errors
+                << _initTime
+                << _bodyTime
+                << _baselineTime
+                << _completeTime
+                << _initStart
+                << _bodyStart
+                << _baselineStart
+                << _completeStart
+                << _itemsProcessed
+                << _bytesProcessed
+                << _bodyCounters
+                << _baselineCounters;
+        },
+        [this] (Message &m) {
+            m >> _status
+                >> _usedResources
+                >> _errors
+                >> _initTime
+                >> _bodyTime
+                >> _baselineTime
+                >> _completeTime
+                >> _initStart
+                >> _bodyStart
+                >> _baselineStart
+                >> _completeStart
+                >> _itemsProcessed
+                >> _bytesProcessed
+                >> _bodyCounters
+                >> _baselineCounters;
+        },
+        [this] (const std::string &error) {
+            _status = Status::FAIL;
+            _errors.push_back(error);
+        },
+        opt
+    );
+
+    _out = std::move(opt.output());
+    _err = std::move(opt.error());
+
+    if (! finish) _status = Status::TIMEOUT;
+}
+
+void DistributedPerformanceTest::_driverRun() {
+    _measure(_body, _baseline);
+}
+
+void DistributedPerformanceTest::_workerRun() {
+    _measure(_workerBody, _workerBaseline);
+}
+
+void DistributedPerformanceTest::_sendResults(Message &m) {
+    m << NodeResult { _bodyTime, _baselineTime, _itemsProcessed, _bytesProcessed };
+}
+
+void DistributedPerformanceTest::_recvResults(uint32_t id, Message &m) {
+    NodeResult r;
+    m >> r;
+
+    if (id == 0) {
+        _bodyTime = r.bodyTime;
+        _baselineTime = r.baselineTime;
+        _itemsProcessed = r.itemsProcessed;
+        _bytesProcessed = r.bytesProcessed;
+    }
+    else {
+        _nodeResults[id] = r;
+    }
+}
+
+void DistributedPerformanceTest::_joinResults(std::stringstream &s) {
+    // nodes start together, so the slowest one bounds the whole run
+    NodeResult total = { _bodyTime, _baselineTime, _itemsProcessed, _bytesProcessed };
+    for (const auto &r : _nodeResults) {
+        if (r.second.bodyTime > total.bodyTime) total.bodyTime = r.second.bodyTime;
+        if (r.second.baselineTime > total.baselineTime) total.baselineTime = r.second.baselineTime;
+        total.itemsProcessed += r.second.itemsProcessed;
+        total.bytesProcessed += r.second.bytesProcessed;
+    }
+
+    std::list<std::string> errors;
+
+    if (_hasBaseline() && _status < Status::TOO_SLOW) {
+        auto error = checkPerformanceMargin(
+            total.bodyTime, total.baselineTime, _performanceMargin, _performanceMarginRatio
+        );
+        if (! error.empty()) {
+            _status = Status::TOO_SLOW;
+            errors.push_back(error);
+        }
+    }
+
+    s << "\"aggregate\": {";
+    if (! errors.empty()) {
+        s << "\n  \"errors\": " << jsonify(errors, 2) << ",";
+    }
+    s << "\n  \"time\": {";
+    s << "\n    \"body\": " << formatDurationJSON(total.bodyTime);
+    if (_hasBaseline()) {
+        s << ",\n    \"baseline\": " << formatDurationJSON(total.baselineTime);
+    }
+    s << "\n  }";
+
+    auto throughput = _throughputReport(total);
+    if (! throughput.empty()) {
+        s << ",\n  \"throughput\": {\n" << indent(throughput, 4) << "\n  }";
+    }
+    s << "\n}";
+}
+
+std::string DistributedPerformanceTest::_throughputReport(const NodeResult &r) {
+    std::stringstream s;
+
+    auto rates = [&r] (uint64_t time) {
+        std::stringstream s;
+        if (r.itemsProcessed > 0) {
+            s << "\n  \"items\": " << formatRateJSON(r.itemsProcessed * 1e9 / time, "items/s");
+        }
+        if (r.bytesProcessed > 0) {
+            if (r.itemsProcessed > 0) s << ",";
+            s << "\n  \"bytes\": " << formatRateJSON(r.bytesProcessed * 1e9 / time, "B/s", 1024);
+        }
+        return s.str();
+    };
+
+    if (r.itemsProcessed == 0 && r.bytesProcessed == 0) return "";
+
+    if (r.bodyTime > 0) {
+        s << "\"body\": {" << rates(r.bodyTime) << "\n}";
+    }
+
+    if (r.baselineTime > 0) {
+        if (r.bodyTime > 0) s << ",\n";
+        s << "\"baseline\": {" << rates(r.baselineTime) << "\n}";
+    }
+
+    return s.str();
+}
+
+void DistributedPerformanceTest::_report(bool driver, std::stringstream &s) {
+    if (! _errors.empty()) {
+        s << _errorReport() << ",\n";
+    }
+
+    s << "\"time\": {";
+    if (_initTime > 0) {
+        s << "\n  \"initialization\": " << formatDurationJSON(_initTime) << ',';
+    }
+    s << "\n  \"body\": " << formatDurationJSON(_bodyTime);
+    if (_hasBaseline()) {
+        s << ",\n  \"baseline\": " << formatDurationJSON(_baselineTime);
+    }
+    if (_completeTime) {
+        s << ",\n  \"cleanup\": " << formatDurationJSON(_completeTime);
+    }
+    s << "\n}";
+
+    auto throughput = _throughputReport({ _bodyTime, _baselineTime, _itemsProcessed, _bytesProcessed });
+    if (! throughput.empty()) {
+        s << ",\n\"throughput\": {\n" << indent(throughput, 2) << "\n}";
+    }
+
+    auto bodyCounters = _counterReport(_bodyCounters);
+    auto baselineCounters = _counterReport(_baselineCounters);
+    if (! bodyCounters.empty()) {
+        s << ",\n\"counters\": {";
+        s << "\n  \"body\": {\n" << indent(bodyCounters, 4) << "\n  }";
+        if (! baselineCounters.empty()) {
+            s << ",\n  \"baseline\": {\n" << indent(baselineCounters, 4) << "\n  }";
+        }
+        s << "\n}";
+    }
+
+    if (_hasMemoryReport()) {
+        s << ",\n\"memory\": {\n" << indent(_memoryReport(), 2) << "\n}";
+    }
+
+    if (_hasNetworkReport()) {
+        s << ",\n\"network\": {\n" << indent(_networkReport(), 2) << "\n}";
+    }
+
+    if (_out.size() > 0) {
+        s << ",\n\"stdout\": \n" << indent(jsonify(std::string((const char *) _out.data(), _out.size())), 2);
+    }
+
+    if (_err.size() > 0) {
+        s << ",\n\"stderr\": \n" << indent(jsonify(std::string((const char *) _err.data(), _err.size())), 2);
+    }
+}
+
+void DistributedPerformanceTest::_trace(bool driver, std::vector<TraceEvent> &events) {
+    UnitTest::_trace(driver, events);
+    if (_baselineStart > 0) events.push_back({ "baseline", 0, _baselineStart, (int64_t) _baselineTime });
+}
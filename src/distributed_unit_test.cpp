@@ -35,7 +35,8 @@ void DistributedUnitTest::_workerRun() {
             timeOf(_onInit);
 
             if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
-            _workerBodyTime = timeOf(_workerBody);
+            _workerBodyStart = traceClock();
+            _workerBodyTime = _timeOf(_workerBody, _bodyCounters);
             if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
 
             timeOf(_onComplete);
@@ -50,13 +51,17 @@ void DistributedUnitTest::_workerRun() {
             m << _status
                 << _usedResources
                 << _errors
-                << _workerBodyTime;
+                << _workerBodyTime
+                << _workerBodyStart
+                << _bodyCounters;
         },
         [this] (Message &m) {
             m >> _status
                 >> _usedResources
                 >> _errors
-                >> _workerBodyTime;
+                >> _workerBodyTime
+                >> _workerBodyStart
+                >> _bodyCounters;
         },
         [this] (const std::string &error) {
             _status = Status::FAIL;
@@ -107,6 +112,11 @@ void DistributedUnitTest::_report(bool driver, std::stringstream &s) {
         s << "\n  \"body\": " << formatDurationJSON(_workerBodyTime);
         s << "\n}";
 
+        auto counters = _counterReport(_bodyCounters);
+        if (! counters.empty()) {
+            s << ",\n\"counters\": {\n" << indent(counters, 2) << "\n}";
+        }
+
         if (_hasMemoryReport()) {
             s << ",\n\"memory\": {\n" << indent(_memoryReport(), 2) << "\n}";
         }
@@ -116,3 +126,12 @@ void DistributedUnitTest::_report(bool driver, std::stringstream &s) {
         s << ",\n\"network\": {\n" << indent(_networkReport(), 2) << "\n}";
     }
 }
+
+void DistributedUnitTest::_trace(bool driver, std::vector<TraceEvent> &events) {
+    if (driver) {
+        UnitTest::_trace(driver, events);
+    }
+    else if (_workerBodyStart > 0) {
+        events.push_back({ "body", 0, _workerBodyStart, (int64_t) _workerBodyTime });
+    }
+}
@@ -13,6 +13,10 @@
 #include <sys/stat.h>
 #include <dlfcn.h>
 #include <dtest_core/util.h>
+#include <dtest_core/affinity.h>
+#include <dtest_core/history.h>
+#include <dtest_core/time_of.h>
+#include <dtest_core/profiler.h>
 #include <vector>
 #include <string>
 #include <unordered_set>
@@ -23,7 +27,26 @@ static std::vector<std::string> dynamicTests;
 
 static bool runWorker = false;
 static uint32_t workerId = 0;
+static bool fetchTests = false;
+static std::string cacheDir;
+static uint32_t launchCount = 0;
+static std::string launchCommand;
 static std::unordered_set<std::string> modules;
+static std::vector<int> cpus;
+static int numaNode = -1;
+static bool pinWorkers = false;
+static uint32_t jobs = 1;
+
+// per user, so that no one else can place test files there
+static std::string defaultCacheDir() {
+    const char *home = getenv("HOME");
+    if (home == nullptr || *home == '\0') return "/tmp/dtest-cache-" + std::to_string(getuid());
+
+    // the parent is created with the same permissions if it does not exist
+    std::string dir = std::string(home) + "/.cache";
+    mkdir(dir.c_str(), 0700);
+    return dir + "/dtest";
+}
 
 static void loadTests(const char *path) {
     std::cerr << "Loading " << path << "\n";
@@ -83,6 +106,44 @@ void printHelp() {
         "                               identifier.\n"
         "    --module <test-module>     Runs one or more test modules and skips all other\n"
         "                               tests.\n"
+        "    --no-local-transport       Always use TCP, even between processes on the\n"
+        "                               same host (default is unix domain sockets).\n"
+        "    --jobs <num-tests>         Runs up to <num-tests> distributed tests at once\n"
+        "                               on disjoint sets of workers (default is 1).\n"
+        "                               Performance tests always run alone.\n"
+        "    --launch <num-workers>     Starts <num-workers> workers for the whole run.\n"
+        "                               Workers are forked locally unless --launch-cmd\n"
+        "                               is given.\n"
+        "    --launch-cmd <command>     Starts each launched worker by running <command>\n"
+        "                               in a shell, replacing {id}, {driver} and {args}\n"
+        "                               with the worker id, the driver address and the\n"
+        "                               arguments needed to join the driver, e.g.\n"
+        "                               \"ssh host /path/to/dtest {args}\".\n"
+        "    --fetch-tests              Downloads the test files from the driver instead\n"
+        "                               of loading local ones.\n"
+        "    --cache-dir <dir>          Caches fetched test files in <dir> (default is\n"
+        "                               ~/.cache/dtest). The directory must belong to\n"
+        "                               the user and be writable by no one else.\n"
+        "    --heartbeat-interval <ms>  Sets how often workers report that they are\n"
+        "                               alive (default is 200 ms).\n"
+        "    --heartbeat-timeout <ms>   Fails the test of a worker that has not reported\n"
+        "                               for <ms> milliseconds, and replaces the worker\n"
+        "                               (default is 2000 ms, 0 disables this check).\n"
+        "    --cpus <list>              Runs the driver, workers and tests only on the\n"
+        "                               CPUs in <list> (e.g. 0-3,8).\n"
+        "    --numa <node>              Runs the driver, workers and tests only on the\n"
+        "                               CPUs of NUMA node <node>, and binds their memory\n"
+        "                               to it.\n"
+        "    --pin-workers              Pins each forked worker to one CPU of the set,\n"
+        "                               with memory bound to that CPU's NUMA node.\n"
+        "    --no-pin-workers           Lets forked workers run on any CPU of the set\n"
+        "                               (default).\n"
+        "    --trace <file>             Writes the timeline of every test, on the driver\n"
+        "                               and all workers, to <file> in Chrome trace-event\n"
+        "                               format.\n"
+        "    --history <file>           Judges performance tests without a baseline\n"
+        "                               against their earlier runs in <file>, and appends\n"
+        "                               the body time of every run that did not regress.\n"
         "\n\n"
     ;
 }
@@ -97,7 +158,8 @@ void parseArguments(int argc, char *argv[], const char *cwd) {
             }
             else if (strcasecmp(argv[i], "--workers") == 0) {
                 uint32_t numWorkers = atoi(argv[++i]);
-                for (uint32_t i = 0; i < numWorkers; ++i) {
+                // id 0 belongs to the driver
+                for (uint32_t i = 1; i <= numWorkers; ++i) {
                     DriverContext::instance->addWorker(i);
                 }
             }
@@ -111,6 +173,49 @@ void parseArguments(int argc, char *argv[], const char *cwd) {
             else if (strcasecmp(argv[i], "--module") == 0) {
                 modules.insert(argv[++i]);
             }
+            else if (strcasecmp(argv[i], "--no-local-transport") == 0) {
+                Socket::useLocalTransport(false);
+            }
+            else if (strcasecmp(argv[i], "--jobs") == 0) {
+                jobs = atoi(argv[++i]);
+                Test::setMaxConcurrentTests(jobs);
+            }
+            else if (strcasecmp(argv[i], "--launch") == 0) {
+                launchCount = atoi(argv[++i]);
+            }
+            else if (strcasecmp(argv[i], "--launch-cmd") == 0) {
+                launchCommand = argv[++i];
+            }
+            else if (strcasecmp(argv[i], "--fetch-tests") == 0) {
+                fetchTests = true;
+            }
+            else if (strcasecmp(argv[i], "--cache-dir") == 0) {
+                cacheDir = argv[++i];
+            }
+            else if (strcasecmp(argv[i], "--heartbeat-interval") == 0) {
+                DriverContext::instance->setHeartbeatInterval(atoi(argv[++i]));
+            }
+            else if (strcasecmp(argv[i], "--heartbeat-timeout") == 0) {
+                DriverContext::instance->setHeartbeatTimeout(atoi(argv[++i]));
+            }
+            else if (strcasecmp(argv[i], "--cpus") == 0) {
+                cpus = parseCpuList(argv[++i]);
+            }
+            else if (strcasecmp(argv[i], "--numa") == 0) {
+                numaNode = atoi(argv[++i]);
+            }
+            else if (strcasecmp(argv[i], "--pin-workers") == 0) {
+                pinWorkers = true;
+            }
+            else if (strcasecmp(argv[i], "--no-pin-workers") == 0) {
+                pinWorkers = false;
+            }
+            else if (strcasecmp(argv[i], "--trace") == 0) {
+                Test::setTraceFile(argv[++i]);
+            }
+            else if (strcasecmp(argv[i], "--history") == 0) {
+                History::open(argv[++i]);
+            }
             else if (strcasecmp(argv[i], "-h") == 0 || strcasecmp(argv[i], "--help") == 0) {
                 printHelp();
                 exit(0);
@@ -130,7 +235,7 @@ void parseArguments(int argc, char *argv[], const char *cwd) {
         }
     }
 
-    if (! gotTestLocation) {
+    if (! gotTestLocation && ! fetchTests) {
         findTests(cwd);
     }
 }
@@ -139,18 +244,45 @@ int main(int argc, char *argv[]) {
     char cwd[PATH_MAX];
     getcwd(cwd, PATH_MAX);
 
-    parseArguments(argc - 1, argv + 1, cwd);
+    // once here, rather than in every sandbox
+    calibratePreciseClock();
+    Profiler::initialize();
+
+    try {
+        parseArguments(argc - 1, argv + 1, cwd);
+
+        if (! cpus.empty() || numaNode >= 0) setAffinity(cpus, numaNode);
+    }
+    catch (const std::runtime_error &e) {
+        std::cerr << e.what() << "\n\n";
+        exit(1);
+    }
 
     if (runWorker) {
         try {
+            if (fetchTests) {
+                if (cacheDir.empty()) cacheDir = defaultCacheDir();
+                for (const auto &path : WorkerContext::fetchTests(workerId, cacheDir)) {
+                    loadTests(path.c_str());
+                }
+            }
             Test::runWorker(workerId);
             exit(0);
         }
+        catch (const std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            exit(1);
+        }
         catch (...) {
             exit(1);
         }
     }
 
+    DriverContext::instance->pinWorkers(pinWorkers);
+
+    DriverContext::instance->launchWorkers(launchCount, launchCommand);
+    DriverContext::instance->serveTests(dynamicTests);
+
     Test::logStatsToStderr(true);
 
     std::fstream logFile;
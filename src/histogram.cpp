@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest_core/histogram.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace dtest;
+
+void Histogram::reset() {
+    size_t size = _index((1lu << _MAX_BITS) - 1) + 1;
+
+    if (_counts.size() != size) _counts = std::vector<uint64_t>(size, 0);
+    else std::fill(_counts.begin(), _counts.end(), 0);
+
+    _count = 0;
+    _min = -1lu;
+    _max = 0;
+    _sum = 0;
+}
+
+void Histogram::add(const Histogram &other) {
+    if (other._count == 0) return;
+    if (_counts.empty()) reset();
+
+    for (size_t i = 0; i < _counts.size(); ++i) _counts[i] += other._counts[i];
+
+    _count += other._count;
+    _sum += other._sum;
+    if (other._min < _min) _min = other._min;
+    if (other._max > _max) _max = other._max;
+}
+
+uint64_t Histogram::_highestEquivalent(size_t index) {
+    if (index < (1lu << _SUB_BITS)) return index;
+
+    int shift = (index >> (_SUB_BITS - 1)) - 1;
+    uint64_t sub = index - ((size_t) shift << (_SUB_BITS - 1));
+    return ((sub + 1) << shift) - 1;
+}
+
+uint64_t Histogram::percentile(double percent) const {
+    if (_count == 0) return 0;
+
+    uint64_t rank = (uint64_t) std::ceil(percent / 100 * _count);
+    if (rank < 1) rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < _counts.size(); ++i) {
+        seen += _counts[i];
+        if (seen >= rank) return std::min(_highestEquivalent(i), _max);
+    }
+
+    return _max;
+}
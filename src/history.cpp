@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest_core/history.h>
+
+#include <fstream>
+#include <sstream>
+#include <ctime>
+
+using namespace dtest;
+
+std::string History::_path;
+std::unordered_map<std::string, std::vector<double>> History::_runs;
+
+void History::open(const std::string &path) {
+    _path = path;
+    _runs.clear();
+
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto timeEnd = line.rfind('\t');
+        if (timeEnd == std::string::npos || timeEnd == 0) continue;
+        auto nameEnd = line.rfind('\t', timeEnd - 1);
+        if (nameEnd == std::string::npos) continue;
+
+        try {
+            _runs[line.substr(0, nameEnd)].push_back(std::stod(line.substr(timeEnd + 1)));
+        }
+        catch (const std::exception &) {
+            // a line cut short by an interrupted run
+        }
+    }
+}
+
+const std::vector<double> & History::runs(const std::string &test) {
+    return _runs[test];
+}
+
+void History::append(const std::string &test, double time) {
+    _runs[test].push_back(time);
+
+    std::stringstream s;
+    s.precision(15);
+    s << test << '\t' << std::time(nullptr) << '\t' << time << '\n';
+
+    // a single write per line, so that concurrent runs do not interleave
+    std::ofstream out(_path, std::ios_base::out | std::ios_base::app);
+    out << s.str();
+}
@@ -33,6 +33,7 @@ struct TrackingException {
 
 static TrackingException allocEx[] = {
     { 0, "_dl_allocate_tls", (size_t) -1 },
+    { 1, "_dl_allocate_tls", (size_t) -1 },
     { 2, "GOMP_parallel", 0x26 },
     { 2, "GOMP_parallel", 0x2a },
     { 2, "GOMP_parallel", 0x2b },
@@ -50,6 +51,7 @@ const size_t nAllocEx = sizeof(allocEx) / sizeof(TrackingException);
 static TrackingException deallocEx[] = {
     { 0, "_dl_deallocate_tls", (size_t) -1 },
     { 0, "_dl_deallocate_tls", (size_t) -1 },
+    { 1, "_dl_deallocate_tls", (size_t) -1 },
     { 0, "pthread_create", (size_t) -1 },
     { 0, "_IO_setb", (size_t) -1 },
 };
@@ -17,21 +17,128 @@ void Message::_exit() {
     sandbox().unlock();
 }
 
+namespace {
+
+struct BufferPool {
+    static const size_t MAX_BUFFERS = 16;
+    static const size_t MAX_BUFFER_SIZE = 1 << 20;
+
+    struct {
+        void *buf;
+        size_t len;
+    } buffers[MAX_BUFFERS];
+    size_t count;
+
+    // the buffers are invisible to memory tracking, so they are freed with
+    // the thread rather than reported
+    inline ~BufferPool() {
+        while (count > 0) libc().free(buffers[--count].buf);
+    }
+};
+
+thread_local BufferPool pool;
+
+}  // end anonymous namespace
+
+void * Message::_acquire(size_t &len) {
+    for (size_t i = pool.count; i > 0; --i) {
+        auto &entry = pool.buffers[i - 1];
+        if (entry.len >= len) {
+            void *buf = entry.buf;
+            len = entry.len;
+            entry = pool.buffers[--pool.count];
+            return buf;
+        }
+    }
+    return libc().malloc(len);
+}
+
+void * Message::_resize(void *buf, size_t len) {
+    return libc().realloc(buf, len);
+}
+
+void Message::_release(void *buf, size_t len) {
+    if (pool.count < BufferPool::MAX_BUFFERS && len <= BufferPool::MAX_BUFFER_SIZE) {
+        pool.buffers[pool.count].buf = buf;
+        pool.buffers[pool.count].len = len;
+        ++pool.count;
+    }
+    else {
+        libc().free(buf);
+    }
+}
+
+void Message::_copyFlattened(const Message &rhs) {
+    size_t len = rhs._buf - (uint8_t *) rhs._allocBuf;
+
+    _allocLen = len + rhs._refLen;
+    _allocBuf = _acquire(_allocLen);
+    _buf = (uint8_t *) _allocBuf;
+    _hasData = rhs._hasData;
+    _refLen = 0;
+
+    size_t pos = 0;
+    for (const auto &ref : rhs._refs) {
+        memcpy(_buf, (uint8_t *) rhs._allocBuf + pos, ref.offset - pos);
+        _buf += ref.offset - pos;
+        memcpy(_buf, ref.data, ref.len);
+        _buf += ref.len;
+        pos = ref.offset;
+    }
+    memcpy(_buf, (uint8_t *) rhs._allocBuf + pos, len - pos);
+    _buf += len - pos;
+}
+
 void Message::send(Socket &socket) {
     size_t len = _buf - (uint8_t *) _allocBuf;
-    *((size_t *) _allocBuf) = len;
-    socket.send(_allocBuf, len);
+    *((size_t *) _allocBuf) = len + _refLen;
+
+    if (_refs.empty()) {
+        socket.send(_allocBuf, len);
+        return;
+    }
+
+    // interleave the owned buffer with the referenced payloads
+    _enter();
+    std::vector<iovec> iov;
+    iov.reserve(2 * _refs.size() + 1);
+
+    size_t pos = 0;
+    for (const auto &ref : _refs) {
+        if (ref.offset > pos) {
+            iov.push_back({ (uint8_t *) _allocBuf + pos, ref.offset - pos });
+        }
+        iov.push_back({ (void *) ref.data, ref.len });
+        pos = ref.offset;
+    }
+    if (len > pos) {
+        iov.push_back({ (uint8_t *) _allocBuf + pos, len - pos });
+    }
+
+    try {
+        socket.sendv(iov.data(), iov.size());
+    }
+    catch (...) {
+        _exit();
+        throw;
+    }
+    _exit();
 }
 
 Message & Message::recv(Socket &socket) {
     size_t len;
     size_t r = socket.recv(&len, sizeof(size_t), true);
+    if (r != sizeof(size_t) && r != 0 && r != -1lu) {
+        // connections are long-lived, so finish a partially received header
+        // rather than losing our place in the stream
+        r = socket.recv((uint8_t *) &len + sizeof(size_t) - r, r);
+    }
     if (r == 0) {
         len -= sizeof(size_t);
 
         _fit(len);
         r = socket.recv(_buf, len);
-        if (r == -1u) throw std::runtime_error("Failed to receive");
+        if (r == -1lu) throw std::runtime_error("Failed to receive");
 
         _hasData = true;
     }
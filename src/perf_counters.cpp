@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest_core/perf_counters.h>
+
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+using namespace dtest;
+
+const char * CounterValues::name(Counter c) {
+    static const char *names[] = {
+        "cycles",
+        "instructions",
+        "llc_misses",
+        "branch_misses",
+        "context_switches",
+        "page_faults",
+    };
+    return names[(int) c];
+}
+
+PerfCounters::PerfCounters(bool enabled) {
+    for (auto &fd : _fd) fd = -1;
+
+    if (! enabled) return;
+
+    _open(Counter::CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, true);
+    _open(Counter::INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, true);
+    _open(Counter::LLC_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, true);
+    _open(Counter::BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, true);
+    _open(Counter::CONTEXT_SWITCHES, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, false);
+    _open(Counter::PAGE_FAULTS, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, false);
+}
+
+PerfCounters::~PerfCounters() {
+    for (auto fd : _fd) {
+        if (fd != -1) close(fd);
+    }
+}
+
+void PerfCounters::_open(Counter c, uint32_t type, uint64_t config, bool group) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (! group || _leader == -1) ? 1 : 0;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int groupFd = group ? _leader : -1;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+    if (fd == -1) return;
+
+    _fd[(int) c] = fd;
+    if (group && _leader == -1) _leader = fd;
+}
+
+void PerfCounters::start() {
+    for (auto fd : _fd) {
+        if (fd != -1) ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    }
+
+    if (_leader != -1) ioctl(_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    for (int i = (int) Counter::CONTEXT_SWITCHES; i < CounterValues::COUNT; ++i) {
+        if (_fd[i] != -1) ioctl(_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void PerfCounters::stop() {
+    for (int i = (int) Counter::CONTEXT_SWITCHES; i < CounterValues::COUNT; ++i) {
+        if (_fd[i] != -1) ioctl(_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    if (_leader != -1) ioctl(_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void PerfCounters::addTo(CounterValues &values) const {
+    for (int i = 0; i < CounterValues::COUNT; ++i) {
+        if (_fd[i] == -1) continue;
+
+        uint64_t data[3];   // value, time enabled, time running
+        if (read(_fd[i], data, sizeof(data)) != sizeof(data)) continue;
+
+        double count = data[0];
+        if (data[2] > 0 && data[2] < data[1]) count *= (double) data[1] / data[2];
+
+        if (values.value[i] < 0) values.value[i] = 0;
+        values.value[i] += (int64_t) count;
+    }
+}
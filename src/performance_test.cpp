@@ -6,31 +6,1162 @@
 #include <dtest_core/performance_test.h>
 #include <dtest_core/util.h>
 #include <dtest_core/time_of.h>
+#include <dtest_core/statistics.h>
+#include <dtest_core/history.h>
+#include <dtest_core/affinity.h>
+
+#include <thread>
 
 using namespace dtest;
 
+std::string dtest::checkPerformanceMargin(
+    uint64_t bodyTime,
+    uint64_t baselineTime,
+    uint64_t margin,
+    double marginRatio
+) {
+    if (marginRatio == 0) {
+        if (bodyTime + margin >= baselineTime) {
+            return "Failed to meet performance requirements with a margin of " + formatDuration(margin);
+        }
+    }
+    else if (bodyTime > baselineTime * marginRatio) {
+        return "Failed to meet performance requirements of "
+            + std::to_string(marginRatio) + " of the baseline time";
+    }
+
+    return "";
+}
+
 void PerformanceTest::_checkPerformance() {
-    if (_performanceMarginRatio == 0) {
-        if (_bodyTime + _performanceMargin >= _baselineTime) {
-            _status = Status::TOO_SLOW;
-            err(
+    // a throughput requirement replaces the comparison of times
+    if (_minThroughputRatio > 0) return;
+
+    auto error = checkPerformanceMargin(_bodyTime, _baselineTime, _performanceMargin, _performanceMarginRatio);
+    if (! error.empty()) {
+        _status = Status::TOO_SLOW;
+        err(error);
+    }
+}
+
+void PerformanceTest::_checkSampledPerformance() {
+    if (_minThroughputRatio > 0) return;
+
+    // the body has to be faster than the baseline by the margin with
+    // significance, not just on the median
+    std::vector<double> required = _bodySamples;
+    for (auto &t : required) {
+        if (_performanceMarginRatio == 0) t += _performanceMargin;
+        else t /= _performanceMarginRatio;
+    }
+
+    _pValue = mannWhitneyLess(required, _baselineSamples);
+
+    if (_pValue >= _significance) {
+        _status = Status::TOO_SLOW;
+
+        std::stringstream p;
+        p << _pValue;
+
+        if (_performanceMarginRatio == 0) {
+            _errors.push_back(
                 "Failed to meet performance requirements with a margin of "
-                + formatDuration(_performanceMargin)
+                + formatDuration(_performanceMargin) + " (p = " + p.str() + ")"
+            );
+        }
+        else {
+            _errors.push_back(
+                "Failed to meet performance requirements of "
+                + std::to_string(_performanceMarginRatio) + " of the baseline time"
+                + " (p = " + p.str() + ")"
             );
         }
     }
+}
+
+void PerformanceTest::_checkCounters() {
+    for (const auto &r : _maxCounterRatios) {
+        auto name = std::string(CounterValues::name(r.first));
+        auto body = _bodyCounters[r.first];
+        auto baseline = _baselineCounters[r.first];
+
+        if (body < 0 || baseline < 0) {
+            _errors.push_back("WARNING - counter " + name + " is unavailable, its requirement was not checked");
+        }
+        else if (body > baseline * r.second) {
+            _status = Status::TOO_SLOW;
+            _errors.push_back(
+                "Failed to meet requirement of " + std::to_string(r.second)
+                + " of the baseline " + name + " (" + std::to_string(body)
+                + " vs " + std::to_string(baseline) + ")"
+            );
+        }
+    }
+}
+
+// average time of one run over n runs of a loop, without the cost of timing
+static double timePerRun(const std::function<void(uint64_t)> &loop, uint64_t n) {
+    if (! loop) return 0;
+
+    uint64_t start = preciseClock();
+    loop(n);
+    uint64_t time = preciseClock() - start;
+
+    return time > timerOverhead() ? (double) (time - timerOverhead()) / n : 0;
+}
+
+// number of runs of a loop that a sample needs to last at least minTime
+static uint64_t calibrate(const std::function<void(uint64_t)> &loop, uint64_t minTime) {
+    if (! loop) return 1;
+
+    uint64_t n = 1;
+    while (timePerRun(loop, n) * n < minTime && n < (1lu << 30)) n *= 2;
+    return n;
+}
+
+bool PerformanceTest::_checkSampleCount() {
+    if (! _threadCounts.empty() && _inputSizes.empty()) {
+        // speedups are judged on the ratios of samples taken in the same
+        // round, which a sign test needs a few of
+        if (_minSpeedups.empty()) return true;
+
+        auto needed = signTestMinSamples(_significance);
+        if (_samples >= needed) return true;
+
+        std::stringstream s;
+        s << _samples << " samples cannot show a significant speedup at a significance level of "
+            << _significance << ". At least " << needed << " are needed";
+
+        _status = Status::FAIL;
+        _errors.push_back(s.str());
+        return false;
+    }
+
+    if (_inputSizes.empty()) {
+        // the comparison of times is replaced by a throughput requirement, or
+        // by the test's history
+        if (_minThroughputRatio > 0 || ! _baseline) return true;
+    }
     else {
-        if (_bodyTime > _baselineTime * _performanceMarginRatio) {
+        // a range compares every size with the baseline, and fits the
+        // medians to a complexity, neither of which one sample does reliably
+        if (! _baseline && ! _hasExpectedComplexity) return true;
+    }
+
+    // with too few samples, no difference is significant, so the test could
+    // never pass
+    auto needed = mannWhitneyMinSamples(_significance);
+    if (_samples >= needed) return true;
+
+    std::stringstream s;
+    s << _samples << " samples cannot show a significant difference at a significance level of "
+        << _significance << ". At least " << needed << " are needed";
+
+    _status = Status::FAIL;
+    _errors.push_back(s.str());
+    return false;
+}
+
+void PerformanceTest::_warnIgnoredOptions() {
+    bool single = _inputSizes.empty() && _threadCounts.empty() && ! _latency && _samples <= 1;
+
+    if (single && (_warmup > 0 || _hasMinSampleTime)) {
+        _errors.push_back("WARNING - .warmup() and .minSampleTime() have no effect without .samples()");
+    }
+    else if ((! _threadCounts.empty() || _latency) && _hasMinSampleTime) {
+        _errors.push_back("WARNING - .minSampleTime() has no effect in thread and latency modes");
+    }
+}
+
+void PerformanceTest::_sampledRun() {
+    auto opt = Sandbox::Options();
+    opt.fork(! _inProcessSandbox);
+    opt.input(_input);
+
+    auto finish = sandbox().run(
+        _timeout < 2000000000lu ? 2000000000lu : _timeout,
+        [this] {
+            _configure();
+
+            // allocated up front, so that samples do not show up as
+            // allocations of the test
+            _bodySamples.reserve(_samples);
+            _baselineSamples.reserve(_samples);
+
+            PerfCounters counters(_perfCounters);
+            auto sample = [&counters] (
+                const Loop &loop,
+                uint64_t n,
+                std::vector<double> &samples,
+                CounterValues &values,
+                Allocations &allocations,
+                bool profile
+            ) {
+                if (profile) Profiler::start();
+                auto allocated = sandbox().allocated();
+                counters.start();
+                double time = timePerRun(loop, n);
+                counters.stop();
+                allocations.add(allocated, sandbox().allocated(), n);
+                samples.push_back(time);
+                if (profile) Profiler::stop();
+                counters.addTo(values);
+            };
+
+            _status = Status::FAIL;
+
+            if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _initStart = traceClock();
+            _initTime = timeOf(_onInit);
+
+            // body and baseline may declare different amounts of work, so
+            // each keeps its own while the other runs
+            uint64_t amounts[2][2] = {
+                { _itemsProcessed, _bytesProcessed },
+                { _itemsProcessed, _bytesProcessed }
+            };
+            int current = 0;
+            auto phase = [this, &amounts, &current] (bool body) {
+                amounts[current][0] = _itemsProcessed;
+                amounts[current][1] = _bytesProcessed;
+                current = body ? 0 : 1;
+                _itemsProcessed = amounts[current][0];
+                _bytesProcessed = amounts[current][1];
+            };
+
+            if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _samplingStart = traceClock();
+
+            for (uint32_t i = 0; i < _warmup; ++i) {
+                phase(true);
+                timeOf(_body);
+                phase(false);
+                timeOf(_baseline);
+            }
+
+            phase(true);
+            _bodyIterations = calibrate(_bodyLoop, _minSampleTime);
+            phase(false);
+            _baselineIterations = calibrate(_baselineLoop, _minSampleTime);
+
+            // body and baseline take turns going first, so that drift in
+            // machine state affects both alike
+            for (uint32_t i = 0; i < _samples; ++i) {
+                if (i % 2 == 0) {
+                    phase(true);
+                    sample(_bodyLoop, _bodyIterations, _bodySamples, _bodyCounters, _bodyAllocations, _profile);
+                    phase(false);
+                    sample(_baselineLoop, _baselineIterations, _baselineSamples, _baselineCounters, _baselineAllocations, false);
+                }
+                else {
+                    phase(false);
+                    sample(_baselineLoop, _baselineIterations, _baselineSamples, _baselineCounters, _baselineAllocations, false);
+                    phase(true);
+                    sample(_bodyLoop, _bodyIterations, _bodySamples, _bodyCounters, _bodyAllocations, _profile);
+                }
+            }
+
+            phase(true);
+            _baselineItemsProcessed = amounts[1][0];
+            _baselineBytesProcessed = amounts[1][1];
+
+            // counts per run, like the times
+            for (int i = 0; i < CounterValues::COUNT; ++i) {
+                if (_bodyCounters.value[i] > 0) _bodyCounters.value[i] /= _samples * _bodyIterations;
+                if (_baselineCounters.value[i] > 0) _baselineCounters.value[i] /= _samples * _baselineIterations;
+            }
+
+            _samplingTime = traceClock() - _samplingStart;
+            if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+
+            _completeStart = traceClock();
+            _completeTime = timeOf(_onComplete);
+            if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+
+            _status = Status::PASS;
+        },
+        [this] (Message &m) {
+            _checkMemoryLeak();
+            _checkTimeout(_samplingTime);
+            if (_profile) _profileStacks = Profiler::collect();
+
+            m << _status
+                << _usedResources
+                << _errors
+                << _initTime
+                << _completeTime
+                << _initStart
+                << _samplingStart
+                << _samplingTime
+                << _completeStart
+                << _bodyIterations
+                << _baselineIterations
+                << _bodySamples
+                << _baselineSamples
+                << _bodyCounters
+                << _baselineCounters
+                << _itemsProcessed
+                << _bytesProcessed
+                << _baselineItemsProcessed
+                << _baselineBytesProcessed
+                << _bodyAllocations
+                << _baselineAllocations
+                << _profileStacks;
+        },
+        [this] (Message &m) {
+            m >> _status
+                >> _usedResources
+                >> _errors
+                >> _initTime
+                >> _completeTime
+                >> _initStart
+                >> _samplingStart
+                >> _samplingTime
+                >> _completeStart
+                >> _bodyIterations
+                >> _baselineIterations
+                >> _bodySamples
+                >> _baselineSamples
+                >> _bodyCounters
+                >> _baselineCounters
+                >> _itemsProcessed
+                >> _bytesProcessed
+                >> _baselineItemsProcessed
+                >> _baselineBytesProcessed
+                >> _bodyAllocations
+                >> _baselineAllocations
+                >> _profileStacks;
+        },
+        [this] (const std::string &error) {
+            _status = Status::FAIL;
+            _errors.push_back(error);
+        },
+        opt
+    );
+
+    _out = std::move(opt.output());
+    _err = std::move(opt.error());
+
+    _bodyTime = median(_bodySamples);
+    _baselineTime = median(_baselineSamples);
+
+    if (! finish) _status = Status::TIMEOUT;
+    else if (_status < Status::TOO_SLOW && ! _judgedByHistory()) {
+        _checkSampledPerformance();
+        _checkCounters();
+    }
+}
+
+void PerformanceTest::_checkRangePerformance() {
+    _rangeBodyTimes.clear();
+    _rangeBaselineTimes.clear();
+
+    for (size_t i = 0; i < _inputSizes.size(); ++i) {
+        _rangeBodyTimes.push_back(median(std::vector<double>(
+            _bodySamples.begin() + i * _samples,
+            _bodySamples.begin() + (i + 1) * _samples
+        )));
+        if (_baseline) {
+            _rangeBaselineTimes.push_back(median(std::vector<double>(
+                _baselineSamples.begin() + i * _samples,
+                _baselineSamples.begin() + (i + 1) * _samples
+            )));
+        }
+    }
+
+    // reported times are those of the largest input
+    _bodyTime = _rangeBodyTimes.back();
+    _baselineTime = _baseline ? _rangeBaselineTimes.back() : 0;
+
+    if (_baseline) {
+        // every size has to be significantly faster by the margin, as with
+        // plain samples, so that one noisy size does not fail the test
+        for (size_t i = 0; i < _inputSizes.size(); ++i) {
+            std::vector<double> required(
+                _bodySamples.begin() + i * _samples,
+                _bodySamples.begin() + (i + 1) * _samples
+            );
+            for (auto &t : required) {
+                if (_performanceMarginRatio == 0) t += _performanceMargin;
+                else t /= _performanceMarginRatio;
+            }
+
+            double p = mannWhitneyLess(required, std::vector<double>(
+                _baselineSamples.begin() + i * _samples,
+                _baselineSamples.begin() + (i + 1) * _samples
+            ));
+
+            if (p >= _significance) {
+                std::stringstream s;
+                s << "Failed to meet performance requirements for input size "
+                    << _inputSizes[i] << " (p = " << p << ")";
+
+                _status = Status::TOO_SLOW;
+                _errors.push_back(s.str());
+            }
+        }
+    }
+
+    if (_hasExpectedComplexity) {
+        std::vector<double> n(_inputSizes.begin(), _inputSizes.end());
+        auto expected = fitComplexity(n, _rangeBodyTimes, _expectedComplexity);
+
+        // Neighbouring complexities often fit about equally well, and noise
+        // or a cache knee decides which one is closest. A faster growing one
+        // has to fit materially better than the expected one.
+        for (int c = (int) _expectedComplexity + 1; c <= (int) Complexity::QUADRATIC; ++c) {
+            auto fit = fitComplexity(n, _rangeBodyTimes, (Complexity) c);
+
+            if (
+                expected.rms > _COMPLEXITY_RMS_RATIO * fit.rms
+                && expected.rms - fit.rms > _COMPLEXITY_RMS_MARGIN
+            ) {
+                _status = Status::TOO_SLOW;
+                _errors.push_back(
+                    std::string("Expected complexity of ") + complexityName(_expectedComplexity)
+                    + " but measured " + complexityName(fit.complexity)
+                );
+                break;
+            }
+        }
+    }
+}
+
+void PerformanceTest::_rangeRun() {
+    auto opt = Sandbox::Options();
+    opt.fork(! _inProcessSandbox);
+    opt.input(_input);
+
+    auto finish = sandbox().run(
+        _timeout < 2000000000lu ? 2000000000lu : _timeout,
+        [this] {
+            _configure();
+
+            _bodySamples.reserve(_inputSizes.size() * _samples);
+            _baselineSamples.reserve(_inputSizes.size() * _samples);
+
+            _status = Status::FAIL;
+
+            if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _initStart = traceClock();
+            _initTime = timeOf(_onInit);
+
+            if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _samplingStart = traceClock();
+
+            for (auto n : _inputSizes) {
+                _inputSize = n;
+
+                for (uint32_t i = 0; i < _warmup; ++i) {
+                    timeOf(_body);
+                    timeOf(_baseline);
+                }
+
+                auto bodyIterations = calibrate(_bodyLoop, _minSampleTime);
+                auto baselineIterations = calibrate(_baselineLoop, _minSampleTime);
+
+                auto sampleBody = [this, bodyIterations] {
+                    if (_profile) Profiler::start();
+                    auto allocated = sandbox().allocated();
+                    double time = timePerRun(_bodyLoop, bodyIterations);
+                    _bodyAllocations.add(allocated, sandbox().allocated(), bodyIterations);
+                    _bodySamples.push_back(time);
+                    if (_profile) Profiler::stop();
+                };
+                auto sampleBaseline = [this, baselineIterations] {
+                    if (! _baseline) return;
+                    auto allocated = sandbox().allocated();
+                    double time = timePerRun(_baselineLoop, baselineIterations);
+                    _baselineAllocations.add(allocated, sandbox().allocated(), baselineIterations);
+                    _baselineSamples.push_back(time);
+                };
+
+                // body and baseline take turns going first, as in sampled runs
+                for (uint32_t i = 0; i < _samples; ++i) {
+                    if (i % 2 == 0) {
+                        sampleBody();
+                        sampleBaseline();
+                    }
+                    else {
+                        sampleBaseline();
+                        sampleBody();
+                    }
+                }
+            }
+
+            _samplingTime = traceClock() - _samplingStart;
+            if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+
+            _completeStart = traceClock();
+            _completeTime = timeOf(_onComplete);
+            if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+
+            _status = Status::PASS;
+        },
+        [this] (Message &m) {
+            _checkMemoryLeak();
+            _checkTimeout(_samplingTime);
+            if (_profile) _profileStacks = Profiler::collect();
+
+            m << _status
+                << _usedResources
+                << _errors
+                << _initTime
+                << _completeTime
+                << _initStart
+                << _samplingStart
+                << _samplingTime
+                << _completeStart
+                << _bodySamples
+                << _baselineSamples
+                << _bodyAllocations
+                << _baselineAllocations
+                << _profileStacks;
+        },
+        [this] (Message &m) {
+            m >> _status
+                >> _usedResources
+                >> _errors
+                >> _initTime
+                >> _completeTime
+                >> _initStart
+                >> _samplingStart
+                >> _samplingTime
+                >> _completeStart
+                >> _bodySamples
+                >> _baselineSamples
+                >> _bodyAllocations
+                >> _baselineAllocations
+                >> _profileStacks;
+        },
+        [this] (const std::string &error) {
+            _status = Status::FAIL;
+            _errors.push_back(error);
+        },
+        opt
+    );
+
+    _out = std::move(opt.output());
+    _err = std::move(opt.error());
+
+    if (! finish) _status = Status::TIMEOUT;
+    else if (_status < Status::TOO_SLOW) _checkRangePerformance();
+}
+
+void * PerformanceTest::_runThread(void *arg) {
+    auto run = (ThreadRun *) arg;
+
+    try {
+        setThreadAffinity(run->cpu);
+        run->pinned = true;
+    }
+    catch (const std::runtime_error &) {
+        run->pinned = false;
+    }
+
+    _threadIndex = run->index;
+    _threadLatencies = &run->latencies;
+
+    run->ready->fetch_add(1);
+    while (! run->go->load()) std::this_thread::yield();
+
+    run->start = preciseClock();
+    (*run->body)();
+    run->end = preciseClock();
+
+    return nullptr;
+}
+
+// runs the body once on each of the threads, released together once all of
+// them have started, and returns the time from the release until the last one
+// finished
+uint64_t PerformanceTest::_timeThreads(const std::function<void()> &body, std::vector<ThreadRun> &runs) {
+    std::atomic<uint32_t> ready(0);
+    std::atomic<bool> go(false);
+
+    size_t created = 0;
+    for (auto &run : runs) {
+        run.body = &body;
+        run.ready = &ready;
+        run.go = &go;
+        if (pthread_create(&run.thread, nullptr, _runThread, &run) != 0) break;
+        ++created;
+    }
+
+    if (created < runs.size()) {
+        go = true;
+        for (size_t i = 0; i < created; ++i) pthread_join(runs[i].thread, nullptr);
+        throw std::runtime_error("Failed to create " + std::to_string(runs.size()) + " threads");
+    }
+
+    while (ready.load() < runs.size()) std::this_thread::yield();
+    uint64_t start = preciseClock();
+    go = true;
+
+    uint64_t end = start;
+    for (auto &run : runs) {
+        pthread_join(run.thread, nullptr);
+        if (run.end > end) end = run.end;
+    }
+
+    return end - start;
+}
+
+double PerformanceTest::_speedup(size_t i) const {
+    // every thread runs the body once, so throughput grows with the number
+    // of threads for the same time
+    return (_scalingTimes[0] / _threadCounts[0]) / (_scalingTimes[i] / _threadCounts[i]);
+}
+
+void PerformanceTest::_checkScaling() {
+    _scalingTimes.clear();
+    for (size_t i = 0; i < _threadCounts.size(); ++i) {
+        _scalingTimes.push_back(median(std::vector<double>(
+            _threadWallTimes.begin() + i * _samples,
+            _threadWallTimes.begin() + (i + 1) * _samples
+        )));
+    }
+
+    // reported time is that of the most threads
+    _bodyTime = _scalingTimes.back();
+
+    auto cpus = currentCpus().size();
+    if (_threadCounts.back() > cpus) {
+        _errors.push_back(
+            "WARNING - running " + std::to_string(_threadCounts.back()) + " threads on "
+            + std::to_string(cpus) + " CPUs, threads share CPUs"
+        );
+    }
+    else if (! _threadsPinned) {
+        _errors.push_back("WARNING - failed to pin threads to CPUs");
+    }
+
+    for (const auto &s : _minSpeedups) {
+        auto it = std::find(_threadCounts.begin(), _threadCounts.end(), s.first);
+        if (it == _threadCounts.end()) {
+            _status = Status::FAIL;
+            _errors.push_back(
+                "Speedup required on " + std::to_string(s.first) + " threads, but the test does not run on "
+                + std::to_string(s.first) + " threads"
+            );
+            continue;
+        }
+
+        // threads sharing CPUs cannot speed up, whatever the body does
+        if (s.first > cpus) {
+            _status = Status::FAIL;
+            _errors.push_back(
+                "Speedup required on " + std::to_string(s.first) + " threads, but only "
+                + std::to_string(cpus) + " CPUs are available"
+            );
+            continue;
+        }
+
+        // the thread counts take turns, so each round of samples gives one
+        // ratio, and most of them have to reach the speedup
+        size_t i = it - _threadCounts.begin();
+        std::vector<double> ratios;
+        for (uint32_t j = 0; j < _samples; ++j) {
+            ratios.push_back(
+                (_threadWallTimes[j] / _threadCounts[0])
+                / (_threadWallTimes[i * _samples + j] / _threadCounts[i])
+            );
+        }
+
+        double p = signTestGreater(ratios, s.second);
+        if (p >= _significance) {
+            std::stringstream e;
+            e << "Failed to meet speedup of " << s.second << " on " << s.first
+                << " threads (measured " << _speedup(i) << ", p = " << p << ")";
+
             _status = Status::TOO_SLOW;
-            err(
-                "Failed to meet performance requirements of "
-                + std::to_string(_performanceMarginRatio) + " of the baseline time"
+            _errors.push_back(e.str());
+        }
+    }
+}
+
+void PerformanceTest::_threadsRun() {
+    auto opt = Sandbox::Options();
+    opt.fork(! _inProcessSandbox);
+    opt.input(_input);
+
+    auto finish = sandbox().run(
+        _timeout < 2000000000lu ? 2000000000lu : _timeout,
+        [this] {
+            _configure();
+
+            auto cpus = currentCpus();
+            if (cpus.empty()) cpus.push_back(0);
+
+            // the runs of every thread count, and where their thread times go.
+            // Latency histograms are sized up front, so that they do not show
+            // up as allocations of the test.
+            std::vector<std::vector<ThreadRun>> runs(_threadCounts.size());
+            std::vector<size_t> offsets(_threadCounts.size());
+            size_t totalTimes = 0;
+            _scalingLatencies.assign(_threadCounts.size(), Histogram());
+            for (size_t i = 0; i < _threadCounts.size(); ++i) {
+                _scalingLatencies[i].reset();
+                runs[i].resize(_threadCounts[i]);
+                for (uint32_t t = 0; t < _threadCounts[i]; ++t) {
+                    runs[i][t].index = t;
+                    runs[i][t].cpu = cpus[t % cpus.size()];
+                    runs[i][t].latencies.reset();
+                }
+                offsets[i] = totalTimes;
+                totalTimes += _threadCounts[i] * _samples;
+            }
+
+            _threadWallTimes.assign(_threadCounts.size() * _samples, 0);
+            _threadTimes.assign(totalTimes, 0);
+
+            _status = Status::FAIL;
+
+            if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _initStart = traceClock();
+            _initTime = timeOf(_onInit);
+
+            if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _samplingStart = traceClock();
+
+            // every thread count is warmed up before any is measured, and the
+            // samples of all counts are interleaved, so that the first count
+            // does not take the cold start on its own
+            for (uint32_t s = 0; s < _warmup; ++s) {
+                for (auto &r : runs) _timeThreads(_body, r);
+            }
+            for (auto &r : runs) {
+                for (auto &run : r) run.latencies.reset();
+            }
+
+            for (uint32_t s = 0; s < _samples; ++s) {
+                for (size_t i = 0; i < runs.size(); ++i) {
+                    if (_profile) Profiler::start();
+                    auto allocated = sandbox().allocated();
+                    _threadWallTimes[i * _samples + s] = _timeThreads(_body, runs[i]);
+                    _bodyAllocations.add(allocated, sandbox().allocated(), runs[i].size());
+                    if (_profile) Profiler::stop();
+                    for (size_t t = 0; t < runs[i].size(); ++t) {
+                        _threadTimes[offsets[i] + s * runs[i].size() + t] = runs[i][t].end - runs[i][t].start;
+                        if (! runs[i][t].pinned) _threadsPinned = false;
+                    }
+                }
+            }
+
+            _samplingTime = traceClock() - _samplingStart;
+            if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+
+            // each thread timed its own operations, which are only put
+            // together once the threads are done
+            for (size_t i = 0; i < runs.size(); ++i) {
+                for (const auto &run : runs[i]) _scalingLatencies[i].add(run.latencies);
+            }
+
+            _completeStart = traceClock();
+            _completeTime = timeOf(_onComplete);
+            if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+
+            _status = Status::PASS;
+        },
+        [this] (Message &m) {
+            _checkMemoryLeak();
+            _checkTimeout(_samplingTime);
+            if (_profile) _profileStacks = Profiler::collect();
+
+            m << _status
+                << _usedResources
+                << _errors
+                << _initTime
+                << _completeTime
+                << _initStart
+                << _samplingStart
+                << _samplingTime
+                << _completeStart
+                << _threadWallTimes
+                << _threadTimes
+                << _threadsPinned
+                << _scalingLatencies
+                << _bodyAllocations
+                << _itemsProcessed
+                << _bytesProcessed
+                << _profileStacks;
+        },
+        [this] (Message &m) {
+            m >> _status
+                >> _usedResources
+                >> _errors
+                >> _initTime
+                >> _completeTime
+                >> _initStart
+                >> _samplingStart
+                >> _samplingTime
+                >> _completeStart
+                >> _threadWallTimes
+                >> _threadTimes
+                >> _threadsPinned
+                >> _scalingLatencies
+                >> _bodyAllocations
+                >> _itemsProcessed
+                >> _bytesProcessed
+                >> _profileStacks;
+        },
+        [this] (const std::string &error) {
+            _status = Status::FAIL;
+            _errors.push_back(error);
+        },
+        opt
+    );
+
+    _out = std::move(opt.output());
+    _err = std::move(opt.error());
+
+    if (! finish) _status = Status::TIMEOUT;
+    else if (_status < Status::TOO_SLOW) _checkScaling();
+}
+
+std::string PerformanceTest::_threadsReport() {
+    std::stringstream s;
+    s << "[";
+
+    size_t offset = 0;
+    for (size_t i = 0; i < _threadCounts.size(); ++i) {
+        auto n = _threadCounts[i];
+        std::vector<double> threadTimes(
+            _threadTimes.begin() + offset,
+            _threadTimes.begin() + offset + n * _samples
+        );
+        offset += n * _samples;
+
+        if (i > 0) s << ",";
+        s << "\n  {";
+        s << "\n    \"threads\": " << n << ",";
+        s << "\n    \"time\": " << formatDurationJSON(_scalingTimes[i]) << ",";
+        s << "\n    \"thread_time\": {";
+        s << " \"min\": " << formatDurationJSON(*std::min_element(threadTimes.begin(), threadTimes.end())) << ",";
+        s << " \"median\": " << formatDurationJSON(median(threadTimes)) << ",";
+        s << " \"max\": " << formatDurationJSON(*std::max_element(threadTimes.begin(), threadTimes.end())) << " },";
+        if (i < _scalingLatencies.size() && _scalingLatencies[i].count() > 0) {
+            s << "\n    \"latency\": {\n" << indent(_latencyReport(_scalingLatencies[i]), 6) << "\n    },";
+        }
+        if (_itemsProcessed > 0) {
+            s << "\n    \"throughput\": " << formatRateJSON(n * _itemsProcessed * 1e9 / _scalingTimes[i], "items/s") << ",";
+        }
+        else if (_bytesProcessed > 0) {
+            s << "\n    \"throughput\": " << formatRateJSON(n * _bytesProcessed * 1e9 / _scalingTimes[i], "B/s", 1024) << ",";
+        }
+        s << "\n    \"speedup\": " << _speedup(i) << ",";
+        s << "\n    \"efficiency\": " << _speedup(i) * _threadCounts[0] / n;
+        s << "\n  }";
+    }
+
+    s << "\n]";
+    return s.str();
+}
+
+void PerformanceTest::_checkAllocations() {
+    auto check = [this] (const char *phase, const Allocations &a) {
+        if (a.countPerRun() > _maxAllocationsPerIteration) {
+            std::stringstream s;
+            s << phase << " made " << a.countPerRun() << " allocations per run, more than the limit of "
+                << _maxAllocationsPerIteration;
+
+            _status = Status::TOO_SLOW;
+            _errors.push_back(s.str());
+        }
+
+        if (a.sizePerRun() > _maxAllocatedBytesPerIteration) {
+            _status = Status::TOO_SLOW;
+            _errors.push_back(
+                std::string(phase) + " allocated " + formatSize((size_t) a.sizePerRun()) + " per run, more than the limit of "
+                + formatSize(_maxAllocatedBytesPerIteration)
             );
         }
+    };
+
+    if (_bodyAllocations.runs > 0) check("Body", _bodyAllocations);
+}
+
+std::string PerformanceTest::_allocationReport() {
+    auto report = [] (const Allocations &a) {
+        std::stringstream s;
+        s << "\"per_run\": " << a.countPerRun();
+        s << ",\n\"bytes_per_run\": " << a.sizePerRun();
+        return s.str();
+    };
+
+    std::stringstream s;
+    s << "\"body\": {\n" << indent(report(_bodyAllocations), 2) << "\n}";
+    if (_baselineAllocations.runs > 0) {
+        s << ",\n\"baseline\": {\n" << indent(report(_baselineAllocations), 2) << "\n}";
     }
+    return s.str();
 }
 
-void PerformanceTest::_driverRun() {
+void PerformanceTest::_checkThroughput() {
+    if (_minItemsPerSecond > 0) {
+        double rate = _bodyTime > 0 ? _itemsProcessed * 1e9 / _bodyTime : 0;
+        if (rate < _minItemsPerSecond) {
+            _status = Status::TOO_SLOW;
+            _errors.push_back(
+                "Throughput of " + formatRate(rate, "items/s") + " is below the required "
+                + formatRate(_minItemsPerSecond, "items/s")
+            );
+        }
+    }
+
+    if (_minBytesPerSecond > 0) {
+        double rate = _bodyTime > 0 ? _bytesProcessed * 1e9 / _bodyTime : 0;
+        if (rate < _minBytesPerSecond) {
+            _status = Status::TOO_SLOW;
+            _errors.push_back(
+                "Throughput of " + formatRate(rate, "B/s", 1024) + " is below the required "
+                + formatRate(_minBytesPerSecond, "B/s", 1024)
+            );
+        }
+    }
+
+    if (_minThroughputRatio > 0 && ! _baseline) {
+        // there is nothing to compare against, and the comparison of times is
+        // skipped as well, so the test would otherwise check nothing
+        _status = Status::FAIL;
+        _errors.push_back(".minThroughputAsBaselineRatio() needs a baseline");
+    }
+    else if (_minThroughputRatio > 0) {
+        // items if both declare them, bytes otherwise
+        bool items = _itemsProcessed > 0 && _baselineItemsProcessed > 0;
+        double body = items ? _itemsProcessed : _bytesProcessed;
+        double baseline = items ? _baselineItemsProcessed : _baselineBytesProcessed;
+
+        if (body == 0 || baseline == 0 || _bodyTime == 0 || _baselineTime == 0) {
+            _status = Status::TOO_SLOW;
+            _errors.push_back("Throughput requirements need the items or bytes processed by the body and baseline");
+        }
+        else if (body / _bodyTime < _minThroughputRatio * baseline / _baselineTime) {
+            _status = Status::TOO_SLOW;
+            _errors.push_back(
+                "Failed to meet throughput requirements of " + std::to_string(_minThroughputRatio)
+                + " times the baseline throughput"
+            );
+        }
+    }
+}
+
+std::string PerformanceTest::_throughputReport() {
+    auto rates = [] (uint64_t items, uint64_t bytes, double time) {
+        std::stringstream s;
+        if (items > 0) {
+            s << "\n  \"items\": " << formatRateJSON(items * 1e9 / time, "items/s");
+        }
+        if (bytes > 0) {
+            if (items > 0) s << ",";
+            s << "\n  \"bytes\": " << formatRateJSON(bytes * 1e9 / time, "B/s", 1024);
+        }
+        return s.str();
+    };
+
+    std::stringstream s;
+
+    bool body = _bodyTime > 0 && (_itemsProcessed > 0 || _bytesProcessed > 0);
+    bool baseline = _baselineTime > 0 && (_baselineItemsProcessed > 0 || _baselineBytesProcessed > 0);
+
+    if (body) {
+        s << "\"body\": {" << rates(_itemsProcessed, _bytesProcessed, _bodyTime) << "\n}";
+    }
+
+    if (baseline) {
+        if (body) s << ",\n";
+        s << "\"baseline\": {" << rates(_baselineItemsProcessed, _baselineBytesProcessed, _baselineTime) << "\n}";
+    }
+
+    return s.str();
+}
+
+bool PerformanceTest::_judgedByHistory() const {
+    return ! _baseline && _inputSizes.empty() && _threadCounts.empty() && ! _latency && History::enabled();
+}
+
+void PerformanceTest::_checkHistory() {
+    auto name = _module + "::" + _name;
+    const auto &runs = History::runs(name);
+
+    _historyRuns = runs.size();
+
+    if (_historyRuns >= _MIN_HISTORY) {
+        // shifts that have persisted are accepted as the new normal
+        size_t start = lastChangePoint(runs, _significance, _MIN_HISTORY);
+        std::vector<double> regime(runs.begin() + start, runs.end());
+
+        _historyRegimeRuns = regime.size();
+        _historyMedian = median(regime);
+        _historyMad = medianAbsoluteDeviation(regime);
+
+        double limit = std::max(
+            _historyMedian * (1 + _regressionTolerance),
+            _historyMedian + 3 * 1.4826 * _historyMad
+        );
+
+        std::vector<double> series = runs;
+        series.push_back(_bodyTime);
+        size_t shift = lastChangePoint(series, _significance, _MIN_HISTORY);
+
+        if (_bodyTime > limit) {
+            _status = Status::TOO_SLOW;
+            _errors.push_back(
+                "Regressed from a historical median of " + formatDuration(_historyMedian)
+                + " to " + formatDuration(_bodyTime)
+            );
+        }
+        else if (shift > start) {
+            // a slowdown that crept in over the last few runs
+            double before = median(std::vector<double>(series.begin() + start, series.begin() + shift));
+            double after = median(std::vector<double>(series.begin() + shift, series.end()));
+
+            if (after > before * (1 + _regressionTolerance)) {
+                _status = Status::TOO_SLOW;
+                _errors.push_back(
+                    "Slowed down from a historical median of " + formatDuration(before)
+                    + " to " + formatDuration(after) + " over the last "
+                    + std::to_string(series.size() - shift) + " runs"
+                );
+            }
+        }
+    }
+
+    // runs that regressed are left out, so that a regression never becomes
+    // the new normal just by failing often enough
+    if (_status < Status::TOO_SLOW) History::append(name, _bodyTime);
+}
+
+void PerformanceTest::_checkLatency() {
+    if (_latencies.count() == 0) {
+        _status = Status::FAIL;
+        _errors.push_back("No operations were timed. Call dtest_time_op() in the body, or set a number of operations");
+        return;
+    }
+
+    for (const auto &p : _maxPercentiles) {
+        auto value = _latencies.percentile(p.first);
+
+        if (value >= p.second) {
+            std::stringstream percentile;
+            percentile << p.first;
+
+            _status = Status::TOO_SLOW;
+            _errors.push_back(
+                "Latency at the " + percentile.str() + "th percentile of " + formatDuration(value)
+                + " is not below " + formatDuration(p.second)
+            );
+        }
+    }
+}
+
+void PerformanceTest::_latencyRun() {
+    auto opt = Sandbox::Options();
+    opt.fork(! _inProcessSandbox);
+    opt.input(_input);
+
+    auto finish = sandbox().run(
+        _timeout < 2000000000lu ? 2000000000lu : _timeout,
+        [this] {
+            _configure();
+
+            // sized up front, so that the histogram does not show up as an
+            // allocation of the test
+            _latencies.reset();
+
+            _status = Status::FAIL;
+
+            if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _initStart = traceClock();
+            _initTime = timeOf(_onInit);
+
+            for (uint32_t i = 0; i < _warmup; ++i) timeOf(_body);
+            _latencies.reset();
+
+            if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _bodyStart = traceClock();
+            if (_profile) Profiler::start();
+            auto allocated = sandbox().allocated();
+            if (_latencyOperations > 0) {
+                const auto &body = _body;
+                for (uint64_t i = 0; i < _latencyOperations; ++i) {
+                    Context::instance()->timeOp(body);
+                }
+            }
+            else {
+                timeOf(_body);
+            }
+            _bodyAllocations.add(allocated, sandbox().allocated(), _latencyOperations > 0 ? _latencyOperations : 1);
+            if (_profile) Profiler::stop();
+            _bodyTime = traceClock() - _bodyStart;
+            if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+
+            _completeStart = traceClock();
+            _completeTime = timeOf(_onComplete);
+            if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+
+            _status = Status::PASS;
+        },
+        [this] (Message &m) {
+            _checkMemoryLeak();
+            _checkTimeout(_bodyTime);
+            if (_profile) _profileStacks = Profiler::collect();
+
+            m << _status
+                << _usedResources
+                << _errors
+                << _initTime
+                << _bodyTime
+                << _completeTime
+                << _initStart
+                << _bodyStart
+                << _completeStart
+                << _latencies
+                << _bodyAllocations
+                << _profileStacks;
+        },
+        [this] (Message &m) {
+            m >> _status
+                >> _usedResources
+                >> _errors
+                >> _initTime
+                >> _bodyTime
+                >> _completeTime
+                >> _initStart
+                >> _bodyStart
+                >> _completeStart
+                >> _latencies
+                >> _bodyAllocations
+                >> _profileStacks;
+        },
+        [this] (const std::string &error) {
+            _status = Status::FAIL;
+            _errors.push_back(error);
+        },
+        opt
+    );
+
+    _out = std::move(opt.output());
+    _err = std::move(opt.error());
+
+    if (! finish) _status = Status::TIMEOUT;
+    else if (_status < Status::TOO_SLOW) _checkLatency();
+}
+
+std::string PerformanceTest::_latencyReport(const Histogram &latencies) {
+    std::stringstream s;
+    s << "\"operations\": " << latencies.count();
+    s << ",\n\"min\": " << formatDurationJSON(latencies.min());
+    s << ",\n\"mean\": " << formatDurationJSON(latencies.mean());
+    s << ",\n\"p50\": " << formatDurationJSON(latencies.percentile(50));
+    s << ",\n\"p90\": " << formatDurationJSON(latencies.percentile(90));
+    s << ",\n\"p99\": " << formatDurationJSON(latencies.percentile(99));
+    s << ",\n\"p99.9\": " << formatDurationJSON(latencies.percentile(99.9));
+    s << ",\n\"max\": " << formatDurationJSON(latencies.max());
+    return s.str();
+}
+
+void PerformanceTest::_baselineRun() {
     UnitTest::_driverRun();
 
     auto opt = Sandbox::Options();
@@ -42,7 +1173,12 @@ void PerformanceTest::_driverRun() {
             _configure();
 
             timeOf(_onInit);
-            _baselineTime = timeOf(_baseline);
+            _baselineStart = traceClock();
+            auto allocated = sandbox().allocated();
+            _baselineTime = _timeOf(_baseline, _baselineCounters);
+            _baselineAllocations.add(allocated, sandbox().allocated(), 1);
+            _baselineItemsProcessed = _itemsProcessed;
+            _baselineBytesProcessed = _bytesProcessed;
             timeOf(_onComplete);
         },
         [this] (Message &m) {
@@ -51,12 +1187,22 @@ void PerformanceTest::_driverRun() {
 
             m << _status
                 << _errors
-                << _baselineTime;
+                << _baselineTime
+                << _baselineStart
+                << _baselineCounters
+                << _baselineItemsProcessed
+                << _baselineBytesProcessed
+                << _baselineAllocations;
         },
         [this] (Message &m) {
             m >> _status
                 >> _errors
-                >> _baselineTime;
+                >> _baselineTime
+                >> _baselineStart
+                >> _baselineCounters
+                >> _baselineItemsProcessed
+                >> _baselineBytesProcessed
+                >> _baselineAllocations;
         },
         [this] (const std::string &error) {
             _status = Status::FAIL;
@@ -66,6 +1212,58 @@ void PerformanceTest::_driverRun() {
     );
 
     if (! finish) _status = Status::TIMEOUT;
+    else if (_status < Status::TOO_SLOW) _checkCounters();
+}
+
+void PerformanceTest::_driverRun() {
+    if (! _inputSizes.empty()) {
+        if (_checkSampleCount()) _rangeRun();
+    }
+    else if (! _threadCounts.empty()) {
+        if (_checkSampleCount()) _threadsRun();
+    }
+    else if (_latency) _latencyRun();
+    else if (_samples > 1) {
+        if (_checkSampleCount()) _sampledRun();
+    }
+    else if (_judgedByHistory()) UnitTest::_driverRun();
+    else _baselineRun();
+
+    _warnIgnoredOptions();
+
+    if (_inputSizes.empty() && _threadCounts.empty() && ! _latency && _status < Status::TOO_SLOW) {
+        _checkThroughput();
+    }
+
+    if (_status < Status::TOO_SLOW) _checkAllocations();
+
+    // without a baseline, the test is judged against its own history
+    if (_judgedByHistory() && _status < Status::TOO_SLOW) _checkHistory();
+
+    _saveProfile();
+}
+
+std::string PerformanceTest::_rangeReport(const std::vector<double> &times) {
+    std::vector<double> n(_inputSizes.begin(), _inputSizes.end());
+    auto best = bestComplexityFit(n, times);
+
+    std::stringstream s;
+    s << "\"times\": [";
+    for (size_t i = 0; i < times.size(); ++i) {
+        if (i > 0) s << ",";
+        s << "\n  { \"n\": " << _inputSizes[i] << ", \"time\": " << formatDurationJSON(times[i]) << " }";
+    }
+    s << "\n],";
+    s << "\n\"complexity\": \"" << complexityName(best.complexity) << "\",";
+    s << "\n\"fits\": {";
+    for (int c = 0; c <= (int) Complexity::QUADRATIC; ++c) {
+        auto fit = fitComplexity(n, times, (Complexity) c);
+        if (c > 0) s << ",";
+        s << "\n  \"" << complexityName(fit.complexity) << "\": { \"coefficient\": " << fit.coefficient
+            << ", \"rms\": " << fit.rms << " }";
+    }
+    s << "\n}";
+    return s.str();
 }
 
 void PerformanceTest::_report(bool driver, std::stringstream &s) {
@@ -78,13 +1276,94 @@ void PerformanceTest::_report(bool driver, std::stringstream &s) {
         s << "\n  \"initialization\": " << formatDurationJSON(_initTime) << ',';
     }
     s << "\n  \"body\": " << formatDurationJSON(_bodyTime);
-    s << ",\n  \"baseline\": " << formatDurationJSON(_baselineTime);
+    if (_baseline && ! _latency && _threadCounts.empty()) {
+        s << ",\n  \"baseline\": " << formatDurationJSON(_baselineTime);
+    }
     if (_completeTime) {
         s << ",\n  \"cleanup\": " << formatDurationJSON(_completeTime);
     }
     s << "\n}";
 
+    auto throughput = _throughputReport();
+    if (! throughput.empty() && _inputSizes.empty() && _threadCounts.empty() && ! _latency) {
+        s << ",\n\"throughput\": {\n" << indent(throughput, 2) << "\n}";
+    }
+
+    if (! _scalingTimes.empty()) {
+        s << ",\n\"threads\": " << _threadsReport();
+    }
+
+    if (_latencies.count() > 0) {
+        s << ",\n\"latency\": {\n" << indent(_latencyReport(_latencies), 2) << "\n}";
+    }
+
+    if (_historyRuns > 0) {
+        s << ",\n\"history\": {";
+        s << "\n  \"runs\": " << _historyRuns;
+        if (_historyRegimeRuns > 0) {
+            s << ",\n  \"runs_since_last_change\": " << _historyRegimeRuns;
+            s << ",\n  \"median\": " << formatDurationJSON(_historyMedian);
+            s << ",\n  \"mad\": " << formatDurationJSON(_historyMad);
+        }
+        s << "\n}";
+    }
+
+    if (! _rangeBodyTimes.empty()) {
+        s << ",\n\"range\": {";
+        s << "\n  \"body\": {\n" << indent(_rangeReport(_rangeBodyTimes), 4) << "\n  }";
+        if (! _rangeBaselineTimes.empty()) {
+            s << ",\n  \"baseline\": {\n" << indent(_rangeReport(_rangeBaselineTimes), 4) << "\n  }";
+        }
+        s << "\n}";
+    }
+    else if (_samples > 1 && ! _bodySamples.empty()) {
+        auto sampleReport = [] (const std::vector<double> &samples, uint64_t iterations) {
+            auto ci = bootstrapMedianInterval(samples);
+
+            std::stringstream s;
+            s << "\"runs_per_sample\": " << iterations;
+            s << ",\n\"median\": " << formatDurationJSON(median(samples));
+            s << ",\n\"mad\": " << formatDurationJSON(medianAbsoluteDeviation(samples));
+            s << ",\n\"ci95\": [ " << formatDurationJSON(ci.low) << ", " << formatDurationJSON(ci.high) << " ]";
+            return s.str();
+        };
+
+        s << ",\n\"statistics\": {";
+        s << "\n  \"samples\": " << _samples << ",";
+        s << "\n  \"warmup\": " << _warmup << ",";
+        s << "\n  \"body\": {\n" << indent(sampleReport(_bodySamples, _bodyIterations), 4) << "\n  },";
+        s << "\n  \"baseline\": {\n" << indent(sampleReport(_baselineSamples, _baselineIterations), 4) << "\n  },";
+        s << "\n  \"p_value\": " << _pValue;
+        s << "\n}";
+    }
+
+    auto bodyCounters = _counterReport(_bodyCounters);
+    auto baselineCounters = _counterReport(_baselineCounters);
+    if (! bodyCounters.empty() || ! baselineCounters.empty()) {
+        s << ",\n\"counters\": {";
+        s << "\n  \"body\": {\n" << indent(bodyCounters, 4) << "\n  },";
+        s << "\n  \"baseline\": {\n" << indent(baselineCounters, 4) << "\n  }";
+        s << "\n}";
+    }
+
+    if (
+        _bodyAllocations.count > 0 || _baselineAllocations.count > 0
+        || _maxAllocationsPerIteration != (uint64_t) -1 || _maxAllocatedBytesPerIteration != (uint64_t) -1
+    ) {
+        s << ",\n\"allocations\": {\n" << indent(_allocationReport(), 2) << "\n}";
+    }
+
+    if (_profile) {
+        s << ",\n\"profile\": {\n" << indent(_profileReport(), 2) << "\n}";
+    }
+
     if (_hasMemoryReport()) {
         s << ",\n\"memory\": {\n" << indent(_memoryReport(), 2) << "\n}";
     }
 }
+
+void PerformanceTest::_trace(bool driver, std::vector<TraceEvent> &events) {
+    UnitTest::_trace(driver, events);
+    if (_samplingStart > 0) events.push_back({ "sampling", 0, _samplingStart, (int64_t) _samplingTime });
+    if (_baselineStart > 0) events.push_back({ "baseline", 0, _baselineStart, (int64_t) _baselineTime });
+}
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest_core/profiler.h>
+#include <dtest_core/sandbox.h>
+
+#include <atomic>
+#include <map>
+#include <unordered_map>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <signal.h>
+#include <sys/time.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cxxabi.h>
+
+using namespace dtest;
+
+// frames of the signal handler itself and of the signal trampoline
+static const int SKIP_FRAMES = 2;
+
+static void **samples = nullptr;
+static int *depths = nullptr;
+static std::atomic<size_t> numSamples(0);
+
+void Profiler::_onSample(int) {
+    int savedErrno = errno;
+
+    size_t i = numSamples.fetch_add(1);
+    if (i < _MAX_SAMPLES) {
+        depths[i] = backtrace(samples + i * _MAX_FRAMES, _MAX_FRAMES);
+    }
+
+    errno = savedErrno;
+}
+
+void Profiler::initialize() {
+    // the first backtrace() loads the unwinder, which is neither safe in a
+    // signal handler nor free of allocations
+    void *frame;
+    backtrace(&frame, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _onSample;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, nullptr);
+}
+
+void Profiler::start(int frequency) {
+    if (samples == nullptr) {
+        // outside of the memory tracked for the test
+        samples = (void **) libc().malloc(_MAX_SAMPLES * _MAX_FRAMES * sizeof(void *));
+        depths = (int *) libc().malloc(_MAX_SAMPLES * sizeof(int));
+    }
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / frequency;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+void Profiler::stop() {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+namespace {
+
+struct Symbol {
+    uintptr_t address;
+    uintptr_t size;
+    std::string name;
+};
+
+// function symbols of an ELF file by address, including the local ones (such
+// as lambdas and static functions) that dladdr() does not see
+struct SymbolTable {
+    bool absolute = false;
+    std::vector<Symbol> symbols;
+
+    SymbolTable(const char *path);
+
+    const char * find(uintptr_t address) const;
+};
+
+SymbolTable::SymbolTable(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ElfW(Ehdr))) {
+        close(fd);
+        return;
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    auto file = (const char *) map;
+    auto ehdr = (const ElfW(Ehdr) *) file;
+
+    if (
+        memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0
+        && ehdr->e_shoff + ehdr->e_shnum * sizeof(ElfW(Shdr)) <= (size_t) st.st_size
+    ) {
+        // executables that are not position independent use absolute addresses
+        absolute = ehdr->e_type == ET_EXEC;
+
+        auto shdr = (const ElfW(Shdr) *) (file + ehdr->e_shoff);
+        for (int i = 0; i < ehdr->e_shnum; ++i) {
+            if (shdr[i].sh_type != SHT_SYMTAB || shdr[i].sh_link >= ehdr->e_shnum) continue;
+
+            auto sym = (const ElfW(Sym) *) (file + shdr[i].sh_offset);
+            auto strtab = file + shdr[shdr[i].sh_link].sh_offset;
+            size_t n = shdr[i].sh_size / sizeof(ElfW(Sym));
+
+            for (size_t j = 0; j < n; ++j) {
+                if (ELF64_ST_TYPE(sym[j].st_info) != STT_FUNC || sym[j].st_value == 0) continue;
+                symbols.push_back({ sym[j].st_value, sym[j].st_size, strtab + sym[j].st_name });
+            }
+        }
+    }
+
+    munmap(map, st.st_size);
+
+    std::sort(symbols.begin(), symbols.end(), [] (const Symbol &a, const Symbol &b) {
+        return a.address < b.address;
+    });
+}
+
+const char * SymbolTable::find(uintptr_t address) const {
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), address, [] (uintptr_t a, const Symbol &s) {
+        return a < s.address;
+    });
+    if (it == symbols.begin()) return nullptr;
+
+    --it;
+    return address < it->address + (it->size > 0 ? it->size : 1) ? it->name.c_str() : nullptr;
+}
+
+}  // end namespace
+
+static std::string frameName(
+    void *address,
+    bool returnAddress,
+    std::unordered_map<std::string, SymbolTable> &tables
+) {
+    // a return address may be just past the end of the calling function
+    void *lookup = returnAddress ? (char *) address - 1 : address;
+
+    Dl_info info;
+    if (! dladdr(lookup, &info)) return "??";
+
+    const char *symbol = info.dli_sname;
+    if (symbol == nullptr && info.dli_fname != nullptr) {
+        auto it = tables.find(info.dli_fname);
+        if (it == tables.end()) it = tables.emplace(info.dli_fname, SymbolTable(info.dli_fname)).first;
+
+        symbol = it->second.find(
+            it->second.absolute
+            ? (uintptr_t) lookup
+            : (uintptr_t) lookup - (uintptr_t) info.dli_fbase
+        );
+    }
+
+    std::string name;
+    if (symbol != nullptr) {
+        int status;
+        char *demangled = abi::__cxa_demangle(symbol, nullptr, 0, &status);
+        name = (status == 0) ? demangled : symbol;
+        free(demangled);
+    }
+    else {
+        const char *module = info.dli_fname != nullptr ? strrchr(info.dli_fname, '/') : nullptr;
+        std::stringstream s;
+        s << (module != nullptr ? module + 1 : "??") << "+" << (void *) ((char *) lookup - (char *) info.dli_fbase);
+        name = s.str();
+    }
+
+    std::replace(name.begin(), name.end(), ';', ':');
+    return name;
+}
+
+std::string Profiler::collect() {
+    size_t n = numSamples.load();
+    if (n > _MAX_SAMPLES) n = _MAX_SAMPLES;
+
+    std::unordered_map<void *, std::string> names;
+    std::unordered_map<std::string, SymbolTable> tables;
+    std::map<std::string, uint64_t> stacks;
+
+    for (size_t i = 0; i < n; ++i) {
+        void **frames = samples + i * _MAX_FRAMES;
+
+        std::string stack;
+        for (int f = depths[i] - 1; f >= SKIP_FRAMES; --f) {
+            auto it = names.find(frames[f]);
+            if (it == names.end()) {
+                it = names.emplace(frames[f], frameName(frames[f], f > SKIP_FRAMES, tables)).first;
+            }
+
+            if (! stack.empty()) stack += ';';
+            stack += it->second;
+        }
+
+        if (! stack.empty()) ++stacks[stack];
+    }
+
+    numSamples = 0;
+
+    std::stringstream s;
+    for (const auto &stack : stacks) {
+        s << stack.first << ' ' << stack.second << '\n';
+    }
+    return s.str();
+}
+
+uint64_t dtest::profileSamples(const std::string &folded) {
+    uint64_t total = 0;
+
+    std::stringstream s(folded);
+    std::string line;
+    while (std::getline(s, line)) {
+        auto space = line.rfind(' ');
+        if (space != std::string::npos) total += std::stoull(line.substr(space + 1));
+    }
+
+    return total;
+}
+
+std::vector<HotFrame> dtest::hotFrames(const std::string &folded, size_t count) {
+    std::map<std::string, uint64_t> self;
+
+    std::stringstream s(folded);
+    std::string line;
+    while (std::getline(s, line)) {
+        auto space = line.rfind(' ');
+        if (space == std::string::npos) continue;
+
+        auto leaf = line.rfind(';', space);
+        leaf = (leaf == std::string::npos) ? 0 : leaf + 1;
+
+        self[line.substr(leaf, space - leaf)] += std::stoull(line.substr(space + 1));
+    }
+
+    std::vector<HotFrame> frames;
+    for (const auto &f : self) frames.push_back({ f.first, f.second });
+
+    std::sort(frames.begin(), frames.end(), [] (const HotFrame &a, const HotFrame &b) {
+        return a.samples > b.samples;
+    });
+    if (frames.size() > count) frames.resize(count);
+
+    return frames;
+}
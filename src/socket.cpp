@@ -11,9 +11,12 @@
 #include <ifaddrs.h>
 #include <net/if.h>
 #include <unistd.h>
-#include <poll.h>
 #include <unordered_map>
 #include <netdb.h>
+#include <sys/un.h>
+#include <cstddef>
+#include <climits>
+#include <poll.h>
 
 using namespace dtest;
 
@@ -28,15 +31,16 @@ using namespace dtest;
 #undef htons
 #undef htonl
 #undef ntohs
+#undef ntohl
 #undef send
 #undef sendto
+#undef sendmsg
 #undef recv
 #undef recvfrom
 #undef shutdown
 #undef close
 #undef accept
 #undef getsockname
-#undef poll
 namespace sys {
     using ::socket;
     using ::connect;
@@ -49,19 +53,36 @@ namespace sys {
     using ::htons;
     using ::htonl;
     using ::ntohs;
+    using ::ntohl;
     using ::send;
     using ::sendto;
+    using ::sendmsg;
     using ::recv;
     using ::recvfrom;
     using ::shutdown;
     using ::close;
     using ::accept;
     using ::getsockname;
-    using ::poll;
 }
 
 size_t Socket::_MTU = _MAX_MTU;
 
+bool Socket::_localTransport = true;
+
+// Listening sockets also accept connections on an abstract unix socket named
+// after their port. Abstract names belong to the network namespace, as do the
+// local addresses for which peers look them up. Nothing keeps the names
+// unique: if one is taken (e.g. by another listener sharing the port through
+// SO_REUSEPORT), bind fails and the listener is only reachable over TCP.
+static socklen_t localName(uint16_t port, sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    int len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "dtest:%u", port);
+
+    return offsetof(sockaddr_un, sun_path) + 1 + len;
+}
+
 void Socket::_resizeMTU(size_t oldMTU) {
 
     if (oldMTU > _MTU) return;
@@ -93,9 +114,12 @@ Socket::Socket(int fd)
 }
 
 Socket::Socket(const sockaddr &addr) {
-    _fd = sys::socket(AF_INET, SOCK_STREAM, 0);
     _addr = addr;
 
+    if (_localTransport && is_local_ipv4(addr) && _connectLocal(addr)) return;
+
+    _fd = sys::socket(AF_INET, SOCK_STREAM, 0);
+
     if (_fd == -1) {
         throw std::runtime_error(
             std::string("Failed to create socket. ") + strerror(errno)
@@ -113,7 +137,7 @@ Socket::Socket(const sockaddr &addr) {
 
 Socket::Socket(uint16_t port, int maxWaitingQueueLength) {
 
-    _fd = sys::socket(AF_INET, SOCK_STREAM, 0);
+    _fd = sys::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
 
     if (_fd == -1) {
         throw std::runtime_error(
@@ -158,6 +182,43 @@ Socket::Socket(uint16_t port, int maxWaitingQueueLength) {
 
     port = get_port(_addr);
     _addr = self_address_ipv4(port);
+
+    if (_localTransport) _listenLocal(maxWaitingQueueLength);
+
+    _events.resize(_MAX_EVENTS);
+}
+
+void Socket::_listenLocal(int maxWaitingQueueLength) {
+    sockaddr_un addr;
+    socklen_t len = localName(get_port(_addr), addr);
+
+    _localFd = sys::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (_localFd == -1) return;
+
+    // the local endpoint is only a shortcut, peers fall back to TCP without it
+    if (
+        sys::bind(_localFd, (sockaddr *) &addr, len) == -1
+        || sys::listen(_localFd, maxWaitingQueueLength) == -1
+    ) {
+        sys::close(_localFd);
+        _localFd = -1;
+    }
+}
+
+bool Socket::_connectLocal(const sockaddr &addr) {
+    sockaddr_un un;
+    socklen_t len = localName(get_port(addr), un);
+
+    _fd = sys::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_fd == -1) return false;
+
+    if (sys::connect(_fd, (sockaddr *) &un, len) == -1) {
+        sys::close(_fd);
+        _fd = -1;
+        return false;
+    }
+
+    return true;
 }
 
 void Socket::send(void *data, size_t len) {
@@ -195,6 +256,50 @@ void Socket::send(void *data, size_t len) {
     }
 }
 
+void Socket::sendv(iovec *iov, size_t count) {
+
+    while (count > 0) {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msghdr));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count < IOV_MAX ? count : IOV_MAX;
+
+        ssize_t sent = sys::sendmsg(
+            _fd, &msg, msg.msg_iovlen < count ? MSG_MORE : 0
+        );
+
+        if (sent != -1) {
+            while (count > 0 && (size_t) sent >= iov->iov_len) {
+                sent -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0) {
+                iov->iov_base = (uint8_t *) iov->iov_base + sent;
+                iov->iov_len -= sent;
+            }
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            throw std::runtime_error(
+                std::string("Failed to send. ") + strerror(errno)
+            );
+        }
+    }
+}
+
+bool Socket::writable() const {
+    pollfd pfd = { _fd, POLLOUT, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+void Socket::setSendBufferSize(int bytes) {
+    if (sys::setsockopt(_fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes)) == -1) {
+        throw std::runtime_error(
+            std::string("Failed to set socket options. ") + strerror(errno)
+        );
+    }
+}
+
 size_t Socket::recv(void *data, size_t len, bool returnOnBlock) {
     size_t maxLen = _INITIAL_SYSCALL_SIZE;
 
@@ -227,11 +332,18 @@ void Socket::close() {
         _fd = -1;
     }
 
+    if (_localFd != -1) {
+        sys::close(_localFd);
+        _localFd = -1;
+    }
+
     for (auto &conn : _openConnections) {
         conn.second->close();
         delete conn.second;
     }
     _openConnections.clear();
+
+    _closeEventLoop();
 }
 
 Socket Socket::accept() {
@@ -243,70 +355,146 @@ Socket Socket::accept() {
     return { incoming, addr };
 }
 
-Socket * Socket::pollOrAcceptOrTimeout() {
+void Socket::acceptPending() {
+    bool watching = _epfd != -1 && _epfdOwner == getpid();
 
-    std::vector<pollfd> pollSocks;
+    for (int fd : { _fd, _localFd }) {
+        if (fd == -1) continue;
 
-    int incoming = -1;
+        while (true) {
+            sockaddr addr;
+            socklen_t len = sizeof(addr);
 
-    pollSocks.push_back({ _fd, POLLIN, 0 });
-    for (const auto &s : _openConnections) {
-        if (s.second->_fd != -1) {
-            pollSocks.push_back(pollfd{ s.second->_fd, POLLIN, 0 });
+            int incoming = accept4(fd, &addr, &len, SOCK_NONBLOCK);
+            if (incoming == -1) break;
+
+            _openConnections[incoming] = new Socket(incoming, addr);
+            if (watching) _watch(incoming);
         }
     }
+}
 
-    int count = sys::poll(pollSocks.data(), pollSocks.size(), 10);
+void Socket::_ensureEventLoop() {
+    pid_t self = getpid();
 
-    for (const auto &p : pollSocks) {
-        if (count == 0) break;
+    if (_epfd != -1 && _epfdOwner == self) return;
 
-        if (p.revents == 0) continue;
+    // an epoll instance inherited through fork() shares its interest list with
+    // the parent process, so every process builds its own
+    if (_epfd != -1) sys::close(_epfd);
 
-        --count;
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd == -1) {
+        throw std::runtime_error(
+            std::string("Failed to create event loop. ") + strerror(errno)
+        );
+    }
+    _epfdOwner = self;
 
-        if (p.fd == _fd) {
-            sockaddr addr;
-            socklen_t len = sizeof(addr);
+    if (_events.size() < _MAX_EVENTS) _events.resize(_MAX_EVENTS);
+    _readyPos = 0;
+    _readyCount = 0;
 
-            if (
-                (p.revents & POLLIN) &&
-                (incoming = accept4(_fd, &addr, &len, SOCK_NONBLOCK)) != -1
-            ) {
-                _openConnections[incoming] = new Socket(incoming, addr);
-            }
-        }
-        else if ((p.revents & POLLIN)) {
-            incoming = p.fd;
-        }
-        else if (
-            (p.revents & POLLRDHUP)
-            || (p.revents & POLLERR)
-            || (p.revents & POLLHUP)
-            || (p.revents & POLLNVAL)
-        ) {
-            auto c = _openConnections[p.fd];
-            c->close();
-            delete c;
-            _openConnections.erase(p.fd);
+    _watch(_fd);
+    if (_localFd != -1) _watch(_localFd);
+    for (const auto &conn : _openConnections) {
+        if (conn.second->_fd != -1) _watch(conn.second->_fd);
+    }
+}
+
+void Socket::_closeEventLoop() {
+    if (_epfd != -1) {
+        sys::close(_epfd);
+        _epfd = -1;
+    }
+
+    _readyPos = 0;
+    _readyCount = 0;
+}
+
+void Socket::_watch(int fd) {
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) == -1 && errno != EEXIST) {
+        throw std::runtime_error(
+            std::string("Failed to watch socket. ") + strerror(errno)
+        );
+    }
+}
+
+void Socket::_unwatch(int fd) {
+    if (_epfd != -1 && _epfdOwner == getpid()) {
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+}
+
+void Socket::_closeConnection(int fd) {
+    auto it = _openConnections.find(fd);
+    if (it == _openConnections.end()) return;
+
+    _unwatch(fd);
+
+    auto c = it->second;
+    _openConnections.erase(it);
+    c->close();
+    delete c;
+}
+
+Socket * Socket::pollOrAcceptOrTimeout(int timeoutMillis) {
+
+    _ensureEventLoop();
+
+    // hand out what is left of the previous batch before waiting again
+    if (_readyPos == _readyCount) {
+        int count = epoll_wait(_epfd, _events.data(), _events.size(), timeoutMillis);
+
+        _readyPos = 0;
+        _readyCount = (count > 0) ? count : 0;
+    }
+
+    while (_readyPos < _readyCount) {
+        const auto &ev = _events[_readyPos++];
+
+        if (ev.data.fd == _fd || ev.data.fd == _localFd) {
+            acceptPending();
+            continue;
         }
+
+        auto it = _openConnections.find(ev.data.fd);
+        if (it == _openConnections.end()) continue;     // disposed since this batch was polled
+
+        if (ev.events & EPOLLIN) return it->second;
+
+        // hang-up or error with no pending data
+        _closeConnection(ev.data.fd);
     }
 
-    return (incoming == -1) ? nullptr : _openConnections[incoming];
+    return nullptr;
 }
 
 Socket & Socket::pollOrAccept() {
     Socket *ptr = nullptr;
-    while (ptr == nullptr) ptr = pollOrAcceptOrTimeout();
+    while (ptr == nullptr) ptr = pollOrAcceptOrTimeout(-1);
     return *ptr;
 }
 
 void Socket::dispose(Socket &sock) {
-    int fd = sock._fd;
-    auto c = _openConnections[fd];
-    c->close();
-    delete c;
-    _openConnections.erase(fd);
+    _closeConnection(sock._fd);
+}
+
+void Socket::disposeClosed() {
+    std::vector<int> closed;
+
+    for (const auto &conn : _openConnections) {
+        char c;
+        if (sys::recv(conn.first, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+            closed.push_back(conn.first);
+        }
+    }
+
+    for (auto fd : closed) _closeConnection(fd);
 }
 
 sockaddr Socket::self_address_ipv4(uint16_t port) {
@@ -343,6 +531,34 @@ sockaddr Socket::self_address_ipv4(uint16_t port) {
     }
 }
 
+bool Socket::is_local_ipv4(const sockaddr &addr) {
+    static std::vector<in_addr_t> localAddresses = [] {
+        std::vector<in_addr_t> addrs;
+
+        ifaddrs *ifaddr;
+        if (getifaddrs(&ifaddr) == 0) {
+            for (auto ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+                if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET) {
+                    addrs.push_back(((sockaddr_in *) ifa->ifa_addr)->sin_addr.s_addr);
+                }
+            }
+            freeifaddrs(ifaddr);
+        }
+
+        return addrs;
+    }();
+
+    auto a = ((const sockaddr_in *) &addr)->sin_addr.s_addr;
+
+    if ((sys::ntohl(a) >> 24) == 127) return true;     // loopback
+
+    for (auto local : localAddresses) {
+        if (a == local) return true;
+    }
+
+    return false;
+}
+
 std::string Socket::ipv4_to_str(const sockaddr &addr) {
     char ipstr[INET_ADDRSTRLEN];
 
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest_core/statistics.h>
+
+#include <algorithm>
+#include <random>
+#include <cmath>
+
+using namespace dtest;
+
+double dtest::median(std::vector<double> x) {
+    if (x.empty()) return 0;
+
+    size_t mid = x.size() / 2;
+    std::nth_element(x.begin(), x.begin() + mid, x.end());
+    double m = x[mid];
+
+    if (x.size() % 2 == 0) {
+        m = (m + *std::max_element(x.begin(), x.begin() + mid)) / 2;
+    }
+
+    return m;
+}
+
+double dtest::medianAbsoluteDeviation(const std::vector<double> &x) {
+    double m = median(x);
+
+    std::vector<double> deviations;
+    deviations.reserve(x.size());
+    for (auto v : x) deviations.push_back(std::fabs(v - m));
+
+    return median(std::move(deviations));
+}
+
+ConfidenceInterval dtest::bootstrapMedianInterval(
+    const std::vector<double> &x,
+    double confidence,
+    int resamples
+) {
+    if (x.size() < 2) {
+        double m = median(x);
+        return { m, m };
+    }
+
+    std::mt19937_64 rng(x.size());
+    std::uniform_int_distribution<size_t> pick(0, x.size() - 1);
+
+    std::vector<double> medians;
+    medians.reserve(resamples);
+
+    std::vector<double> resample(x.size());
+    for (int r = 0; r < resamples; ++r) {
+        for (auto &v : resample) v = x[pick(rng)];
+        medians.push_back(median(resample));
+    }
+
+    std::sort(medians.begin(), medians.end());
+
+    double tail = (1 - confidence) / 2;
+    size_t low = (size_t) (tail * (resamples - 1));
+    size_t high = (size_t) ((1 - tail) * (resamples - 1));
+
+    return { medians[low], medians[high] };
+}
+
+double dtest::mannWhitneyLess(const std::vector<double> &a, const std::vector<double> &b) {
+    if (a.empty() || b.empty()) return 1;
+
+    struct Value {
+        double value;
+        bool fromA;
+    };
+
+    std::vector<Value> all;
+    all.reserve(a.size() + b.size());
+    for (auto v : a) all.push_back({ v, true });
+    for (auto v : b) all.push_back({ v, false });
+
+    std::sort(
+        all.begin(),
+        all.end(),
+        [] (const Value &x, const Value &y) { return x.value < y.value; }
+    );
+
+    // average ranks over ties
+    double rankSumA = 0;
+    double tieTerm = 0;
+    for (size_t i = 0; i < all.size(); ) {
+        size_t j = i;
+        while (j < all.size() && all[j].value == all[i].value) ++j;
+
+        double rank = (i + 1 + j) / 2.0;
+        for (size_t k = i; k < j; ++k) {
+            if (all[k].fromA) rankSumA += rank;
+        }
+
+        double t = j - i;
+        tieTerm += t * t * t - t;
+
+        i = j;
+    }
+
+    double na = a.size();
+    double nb = b.size();
+    double n = na + nb;
+
+    double u = rankSumA - na * (na + 1) / 2;
+    double mean = na * nb / 2;
+    double variance = na * nb / 12 * ((n + 1) - tieTerm / (n * (n - 1)));
+
+    if (variance <= 0) return 0.5;
+
+    // a small U means that a tends to be smaller
+    double z = (u - mean + 0.5) / std::sqrt(variance);
+    return 0.5 * std::erfc(-z / std::sqrt(2.0));
+}
+
+size_t dtest::mannWhitneyMinSamples(double alpha) {
+    for (size_t n = 2; n < 1000; ++n) {
+        std::vector<double> a(n), b(n);
+        for (size_t i = 0; i < n; ++i) {
+            a[i] = i;
+            b[i] = n + i;
+        }
+        if (mannWhitneyLess(a, b) < alpha) return n;
+    }
+    return 1000;
+}
+
+double dtest::signTestGreater(const std::vector<double> &x, double threshold) {
+    size_t above = 0;
+    size_t n = 0;
+    for (auto v : x) {
+        if (v == threshold) continue;
+        if (v > threshold) ++above;
+        ++n;
+    }
+
+    if (n == 0) return 1;
+
+    // probability of at least as many values above the threshold if each
+    // were equally likely to fall on either side
+    double p = 0;
+    for (size_t k = above; k <= n; ++k) {
+        p += std::exp(
+            std::lgamma(n + 1.0) - std::lgamma(k + 1.0) - std::lgamma(n - k + 1.0)
+            - n * std::log(2.0)
+        );
+    }
+
+    return p < 1 ? p : 1;
+}
+
+size_t dtest::signTestMinSamples(double alpha) {
+    for (size_t n = 1; n < 1000; ++n) {
+        if (signTestGreater(std::vector<double>(n, 1), 0) < alpha) return n;
+    }
+    return 1000;
+}
+
+size_t dtest::lastChangePoint(const std::vector<double> &x, double alpha, size_t minSegment) {
+    if (minSegment < 1) minSegment = 1;
+
+    size_t start = 0;
+    while (x.size() >= start + 2 * minSegment) {
+        size_t candidates = x.size() - start - 2 * minSegment + 1;
+
+        double bestP = 1;
+        size_t best = 0;
+        for (size_t k = start + minSegment; k + minSegment <= x.size(); ++k) {
+            std::vector<double> a(x.begin() + start, x.begin() + k);
+            std::vector<double> b(x.begin() + k, x.end());
+
+            double p = 2 * std::min(mannWhitneyLess(a, b), mannWhitneyLess(b, a)) * candidates;
+            if (p < bestP) {
+                bestP = p;
+                best = k;
+            }
+        }
+
+        if (bestP >= alpha) break;
+        start = best;
+    }
+
+    return start;
+}
+
+const char * dtest::complexityName(Complexity c) {
+    static const char *names[] = {
+        "O(1)",
+        "O(log n)",
+        "O(n)",
+        "O(n log n)",
+        "O(n^2)",
+    };
+    return names[(int) c];
+}
+
+static double complexityOf(Complexity c, double n) {
+    switch (c) {
+    case Complexity::CONSTANT:
+        return 1;
+    case Complexity::LOGARITHMIC:
+        return std::log2(n);
+    case Complexity::LINEAR:
+        return n;
+    case Complexity::N_LOG_N:
+        return n * std::log2(n);
+    case Complexity::QUADRATIC:
+        return n * n;
+    }
+    return 1;
+}
+
+ComplexityFit dtest::fitComplexity(
+    const std::vector<double> &n,
+    const std::vector<double> &time,
+    Complexity complexity
+) {
+    // errors are relative to the measured time, so that small inputs weigh
+    // as much as large ones
+    double fr = 0, ff = 0;
+    size_t points = 0;
+    for (size_t i = 0; i < n.size(); ++i) {
+        if (time[i] <= 0) continue;
+
+        double f = complexityOf(complexity, n[i]) / time[i];
+        fr += f;
+        ff += f * f;
+        ++points;
+    }
+
+    ComplexityFit fit = { complexity, ff > 0 ? fr / ff : 0, 0 };
+
+    double sse = 0;
+    for (size_t i = 0; i < n.size(); ++i) {
+        if (time[i] <= 0) continue;
+
+        double e = 1 - fit.coefficient * complexityOf(complexity, n[i]) / time[i];
+        sse += e * e;
+    }
+    fit.rms = points > 0 ? std::sqrt(sse / points) : 0;
+
+    return fit;
+}
+
+ComplexityFit dtest::bestComplexityFit(const std::vector<double> &n, const std::vector<double> &time) {
+    ComplexityFit best = fitComplexity(n, time, Complexity::CONSTANT);
+
+    for (auto c : { Complexity::LOGARITHMIC, Complexity::LINEAR, Complexity::N_LOG_N, Complexity::QUADRATIC }) {
+        auto fit = fitComplexity(n, time, c);
+        if (fit.rms < best.rms) best = fit;
+    }
+
+    return best;
+}
@@ -7,7 +7,16 @@
 
 #include <algorithm>
 #include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <poll.h>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <cstring>
 #include <dtest_core/util.h>
+#include <dtest_core/affinity.h>
 
 using namespace dtest;
 
@@ -23,6 +32,9 @@ void Test::_run() {
     if (_enabled) {
         Context::instance()->_currentTest = this;
 
+        _traceEvents.clear();
+        int64_t start = traceClock();
+
         if (_isDriver) {
             if (_distributed()) {
                 if (_numWorkers == 0) _numWorkers = _defaultNumWorkers;
@@ -45,8 +57,12 @@ void Test::_run() {
 
         _success = _status == _expectedStatus;
 
+        _trace(_isDriver, _traceEvents);
+        if (_isDriver) _traceEvents.push_back({ "test", 0, start, traceClock() - start });
+
         std::stringstream s;
         _report(_isDriver, s);
+        if (! _joinedReport.empty()) s << ",\n" << _joinedReport;
         _detailedReport = s.str();
     }
     else {
@@ -84,8 +100,16 @@ bool Test::_logStatsToStderr = false;
 
 bool Test::_isDriver = false;
 
+thread_local uint32_t Test::_threadIndex = 0;
+
+thread_local Histogram * Test::_threadLatencies = nullptr;
+
 uint16_t Test::_defaultNumWorkers = 4;
 
+uint32_t Test::_maxConcurrentTests = 1;
+
+std::string Test::_traceFile;
+
 std::string Test::_errorReport() {
     std::stringstream s;
 
@@ -177,6 +201,21 @@ bool Test::runAll(
 
     auto start = std::chrono::high_resolution_clock::now();
 
+    std::ofstream trace;
+    int64_t traceStart = traceClock();
+    bool firstTraceEvent = true;
+    std::set<uint32_t> traceNodes;
+
+    if (! _traceFile.empty()) {
+        trace.open(_traceFile, std::ios_base::out | std::ios_base::trunc);
+        trace << "{\"traceEvents\": [";
+    }
+
+    auto traceEvent = [&] (const std::string &event) {
+        trace << (firstTraceEvent ? "\n  " : ",\n  ") << event;
+        firstTraceEvent = false;
+    };
+
     std::unordered_map<Status, uint32_t> expectedStatusSummary;
     std::unordered_map<Status, uint32_t> unExpectedStatusSummary;
     size_t runCount = 0;
@@ -184,11 +223,11 @@ bool Test::runAll(
     size_t successCount = 0;
     bool firstLog = true;
 
-    while (! ready.empty()) {
-
-        auto test = ready.front();
-        ready.pop_front();
+    auto selected = [&modules] (Test *test) {
+        return modules.empty() || modules.count(test->_module) != 0;
+    };
 
+    auto logName = [&runCount] (Test *test) {
         auto testnum = std::to_string(runCount + 1);
         testnum.resize(5, ' ');
 
@@ -204,15 +243,14 @@ bool Test::runAll(
             shortTestName.resize(52, ' ');
         }
 
-        if (_logStatsToStderr) {
-            std::cerr << "RUNNING TEST #" << testnum << "  " << shortTestName  << "   ";
-        }
+        std::cerr << "RUNNING TEST #" << testnum << "  " << shortTestName  << "   ";
+    };
 
-        if (modules.empty() || modules.count(test->_module) != 0) test->_run();
-        else test->_skip();
+    auto complete = [&] (Test *test) {
+        auto testname = test->_module + "::" + test->_name;
 
         if (test->_status == Status::SKIP) {
-            if (_logStatsToStderr) {
+            if (_logStatsToStderr && _maxConcurrentTests == 1) {
                 std::cerr << "\r";
                 std::cerr << std::string(80, ' ');
                 std::cerr << "\r";
@@ -251,7 +289,36 @@ bool Test::runAll(
             }
             out << "\n    }";
             out.flush();
-            if (_logStatsToStderr) std::cerr << (test->_success ? "PASS" : "FAIL") << "\n";
+
+            if (trace.is_open()) {
+                // concurrent tests overlap, so each one gets its own row
+                size_t tid = _maxConcurrentTests > 1 ? runCount : 0;
+
+                for (const auto &e : test->_traceEvents) {
+                    std::stringstream s;
+                    s << std::fixed << std::setprecision(3)
+                        << "{\"name\": " << jsonify(testname + " " + e.name)
+                        << ", \"cat\": " << jsonify(test->_module)
+                        << ", \"ph\": \"X\""
+                        << ", \"ts\": " << (e.start - traceStart) / 1000.0
+                        << ", \"dur\": " << e.duration / 1000.0
+                        << ", \"pid\": " << e.node
+                        << ", \"tid\": " << tid;
+                    if (e.node != 0) {
+                        s << ", \"args\": {\"clock_error_us\": " << e.clockError / 1000.0 << "}";
+                    }
+                    s << "}";
+                    traceEvent(s.str());
+                    traceNodes.insert(e.node);
+                }
+                trace.flush();
+            }
+
+            if (_logStatsToStderr) {
+                // concurrent tests are only logged once they finish
+                if (_maxConcurrentTests > 1) logName(test);
+                std::cerr << (test->_success ? "PASS" : "FAIL") << "\n";
+            }
         }
 
         if (test->_success) {
@@ -280,10 +347,69 @@ bool Test::runAll(
 
         ++runCount;
         delete test;
+    };
+
+    auto &driver = DriverContext::instance;
+
+    while (! ready.empty() || driver->_hasConcurrentTests()) {
+
+        // Distributed tests are handed to concurrent runners when allowed.
+        // Everything else runs here, in order. Timed tests wait for the
+        // runners to finish, and nothing else runs while they do.
+        Test *test = nullptr;
+        bool launch = false;
+
+        for (auto it = ready.begin(); it != ready.end(); ++it) {
+            auto t = *it;
+            bool run = t->_enabled && selected(t);
+
+            if (run && t->_timed()) {
+                if (driver->_hasConcurrentTests()) break;
+            }
+            else if (_maxConcurrentTests > 1 && run && t->_distributed()) {
+                if (! driver->_canLaunch(t)) continue;
+                launch = true;
+            }
+
+            test = t;
+            ready.erase(it);
+            break;
+        }
+
+        if (test == nullptr) {
+            complete(driver->_waitForConcurrentTest());
+        }
+        else if (launch) {
+            driver->_launch(test);
+        }
+        else {
+            if (_logStatsToStderr && _maxConcurrentTests == 1) logName(test);
+
+            if (selected(test)) test->_run();
+            else test->_skip();
+
+            complete(test);
+        }
     }
 
     auto end = std::chrono::high_resolution_clock::now();
 
+    if (trace.is_open()) {
+        for (auto node : traceNodes) {
+            std::string name = node == 0 ? "driver" : "worker " + std::to_string(node);
+            traceEvent(
+                "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": "
+                + std::to_string(node)
+                + ", \"args\": {\"name\": " + jsonify(name) + "}}"
+            );
+        }
+
+        trace << "\n]}\n";
+        trace.close();
+    }
+
+    driver->_stop();
+
     out << "\n  }";
 
     // summary
@@ -369,11 +495,84 @@ void Test::runWorker(uint32_t id) {
 
 Context * Context::_currentCtx = nullptr;
 
+Message Context::_recvFromPeer(uint32_t rank, uint32_t tag) {
+    sandbox().lock();
+
+    while (true) {
+        for (auto it = _peerMessages.begin(); it != _peerMessages.end(); ++it) {
+            if (it->src == rank && it->tag == tag) {
+                Message m = std::move(it->message);
+                _peerMessages.erase(it);
+
+                sandbox().unlock();
+                return m;
+            }
+        }
+
+        _waitForPeerEvent();
+    }
+}
+
+uint32_t Context::_rankOf(uint32_t id) const {
+    if (id == 0) return 0;
+
+    auto it = std::lower_bound(_peerIds.begin(), _peerIds.end(), id);
+    if (it == _peerIds.end() || *it != id) return -1u;
+
+    return it - _peerIds.begin() + 1;
+}
+
+void Context::sendTo(uint32_t id, Message &message) {
+    uint32_t rank = _rankOf(id);
+    if (rank == -1u || rank == _rank()) {
+        auto error = "Cannot send to worker " + std::to_string(id);
+        sandbox().lock();
+        throw TestFailureException(error.c_str());
+    }
+
+    _sendToPeer(rank, message);
+}
+
+Message Context::recvFrom(uint32_t id) {
+    uint32_t rank = _rankOf(id);
+    if (rank == -1u || rank == _rank()) {
+        auto error = "Cannot receive from worker " + std::to_string(id);
+        sandbox().lock();
+        throw TestFailureException(error.c_str());
+    }
+
+    return _recvFromPeer(rank, _POINT_TO_POINT_TAG);
+}
+
+void Context::barrier() {
+    uint32_t tag = _collectiveTag++;
+
+    for (uint32_t c = _treeChildrenBegin(); c < _treeChildrenEnd(); ++c) {
+        _recvFromPeer(c, tag);
+    }
+
+    if (_rank() != 0) {
+        Message m = _createPeerMessage(tag);
+        _sendToPeer(_treeParent(), m);
+        _recvFromPeer(_treeParent(), tag);
+    }
+
+    for (uint32_t c = _treeChildrenBegin(); c < _treeChildrenEnd(); ++c) {
+        Message m = _createPeerMessage(tag);
+        _sendToPeer(c, m);
+    }
+}
+
 // DriverContext::WorkerHandle /////////////////////////////////////////////////
 
-void DriverContext::WorkerHandle::run(const Test *test) {
+void DriverContext::WorkerHandle::run(
+    const Test *test,
+    const std::vector<uint32_t> &peerIds,
+    const std::vector<sockaddr> &peerAddrs
+) {
     Message m;
-    m << OpCode::RUN_TEST << test->_module << test->_name;
+    m << OpCode::RUN_TEST << test->_module << test->_name << peerIds << peerAddrs
+        << DriverContext::instance->_runnerPort << DriverContext::instance->_testSeq;
     m.send(_socket);
 }
 
@@ -395,8 +594,14 @@ void DriverContext::WorkerHandle::terminate() {
 
 // DriverContext ///////////////////////////////////////////////////////////////
 
-DriverContext::WorkerHandle DriverContext::_spawnWorker() {
+uint32_t DriverContext::_nextWorkerId() const {
     uint32_t id = _workers.size() + 1;
+    while (_workers.count(id) != 0) ++id;
+    return id;
+}
+
+DriverContext::WorkerHandle DriverContext::_spawnWorker() {
+    uint32_t id = _nextWorkerId();
     pid_t pid = fork();
 
     if (pid == 0) {
@@ -404,6 +609,23 @@ DriverContext::WorkerHandle DriverContext::_spawnWorker() {
         for (int fd = getdtablesize(); fd > 2; --fd) close(fd);
 
         try {
+            if (_pinWorkers) {
+                // CPUs are handed out round-robin by id; the driver is not
+                // pinned, and workers share CPUs once they outnumber them
+                auto cpus = currentCpus();
+                if (! cpus.empty()) {
+                    int cpu = cpus[id % cpus.size()];
+                    try {
+                        setAffinity({ cpu }, numaNodeOf(cpu));
+                    }
+                    catch (const std::runtime_error &) {
+                        // memory binding may not be permitted (e.g. in a
+                        // container); the CPU alone still isolates the worker
+                        setAffinity({ cpu });
+                    }
+                }
+            }
+
             Test::runWorker(id);
             exit(0);
         }
@@ -418,17 +640,139 @@ DriverContext::WorkerHandle DriverContext::_spawnWorker() {
     }
 }
 
+static void replaceAll(std::string &str, const std::string &from, const std::string &to) {
+    for (
+        auto pos = str.find(from);
+        pos != std::string::npos;
+        pos = str.find(from, pos + to.size())
+    ) {
+        str.replace(pos, from.size(), to);
+    }
+}
+
+uint32_t DriverContext::_launchWorker() {
+    if (_launchCommand.empty()) {
+        auto id = _spawnWorker()._id;
+        _launchedWorkers.push_back(id);
+        return id;
+    }
+
+    uint32_t id = _nextWorkerId();
+
+    auto cmd = _launchCommand;
+    replaceAll(
+        cmd,
+        "{args}",
+        "--driver {driver} --worker-id {id} --fetch-tests --heartbeat-interval "
+            + std::to_string(_heartbeatInterval)
+    );
+    replaceAll(cmd, "{driver}", Socket::ipv4_to_str(_address));
+    replaceAll(cmd, "{id}", std::to_string(id));
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        for (int fd = getdtablesize(); fd > 2; --fd) close(fd);
+
+        execl("/bin/sh", "sh", "-c", cmd.c_str(), (char *) NULL);
+        _exit(127);
+    }
+
+    _workers[id] = WorkerHandle(id, pid);
+    _launchedWorkers.push_back(id);
+    return id;
+}
+
+void DriverContext::_launchWorkers() {
+    for (uint32_t i = 0; i < _launchCount; ++i) {
+        _launchWorker();
+    }
+}
+
 void DriverContext::_start() {
     _socket = Socket(_port, 128);
     _address = _socket.address();
 
-    _superSocket = Socket(_port == 0 ? 0 : _port + 1, 128);
+    if (_port == 0 && ! _launchCommand.empty()) {
+        // launched workers only know the driver's address and expect the
+        // super socket on the next port
+        while (true) {
+            try {
+                _superSocket = Socket(Socket::get_port(_address) + 1, 128);
+                break;
+            }
+            catch (const std::runtime_error &) {
+                _socket = Socket(0, 128);
+                _address = _socket.address();
+            }
+        }
+    }
+    else {
+        _superSocket = Socket(_port == 0 ? 0 : _port + 1, 128);
+    }
     _superAddress = _superSocket.address();
+
+    _launchWorkers();
+}
+
+void DriverContext::_stop() {
+    for (auto id : _launchedWorkers) {
+        auto it = _workers.find(id);
+        if (it == _workers.end()) continue;
+
+        if (it->second._running && _lostWorkers.count(id) == 0) {
+            it->second.terminate();
+        }
+        else {
+            kill(it->second._pid, SIGTERM);
+            waitpid(it->second._pid, NULL, 0);
+        }
+
+        _workers.erase(it);
+    }
+    _launchedWorkers.clear();
+}
+
+void DriverContext::_loadTestFiles() {
+    if (_testFileContents.size() == _testFiles.size()) return;
+
+    std::vector<std::string> hashes;
+    std::vector<Buffer> contents;
+
+    for (const auto &path : _testFiles) {
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        if (! f.is_open()) {
+            throw std::runtime_error("Failed to open test file " + path + ". " + strerror(errno));
+        }
+
+        Buffer content((size_t) f.tellg());
+        f.seekg(0);
+        if (! f.read((char *) content.data(), content.size())) {
+            throw std::runtime_error("Failed to read test file " + path);
+        }
+
+        hashes.push_back(sha256(content.data(), content.size()));
+        contents.push_back(std::move(content));
+    }
+
+    _testFileHashes = std::move(hashes);
+    _testFileContents = std::move(contents);
 }
 
 uint32_t DriverContext::_waitForSuperEvent() {
     while (true) {
-        auto &conn = _superSocket.pollOrAccept();
+        // heartbeats pile up while the driver is busy, so workers are only
+        // judged once everything pending has been read
+        auto ptr = _superSocket.pollOrAcceptOrTimeout(0);
+        if (ptr == nullptr) {
+            auto lost = _lostWorkers.size();
+            _checkWorkers();
+            if (_lostWorkers.size() != lost) return -1;
+
+            ptr = _superSocket.pollOrAcceptOrTimeout(_heartbeatInterval);
+            if (ptr == nullptr) continue;
+        }
+        auto &conn = *ptr;
 
         Message m;
         try {
@@ -450,14 +794,78 @@ uint32_t DriverContext::_waitForSuperEvent() {
             if (it == _workers.end()) return -1;
             m >> it->second._addr;
             it->second._running = true;
+            _heartbeats[id] = std::chrono::steady_clock::now();
+
+            // the worker opens its long-lived event connection before
+            // announcing itself. Accept it here so that it outlives the
+            // sandboxed driver bodies that read from it.
+            _socket.acceptPending();
         }
         break;
 
         case OpCode::FINISHED_TEST: {
-            auto it = _allocatedWorkers.find(id);
-            if (it == _allocatedWorkers.end()) return -1;
-            it->second._done = true;
-            m >> it->second._status >> it->second._detailedReport;
+            auto w = _findAllocatedWorker(id);
+            if (w == nullptr) return -1;
+            w->_done = true;
+            m >> w->_status >> w->_detailedReport >> w->_traceEvents;
+
+            // worker spans are moved onto the driver's clock
+            const auto &sync = _clockSyncs[id];
+            for (auto &e : w->_traceEvents) {
+                e.node = id;
+                e.start -= sync.offset;
+                e.clockError = sync.error;
+            }
+
+            w->_results = std::move(m);
+        }
+        break;
+
+        case OpCode::HEARTBEAT: {
+            _heartbeats[id] = std::chrono::steady_clock::now();
+        }
+        break;
+
+        case OpCode::FETCH_TESTS: {
+            try {
+                _loadTestFiles();
+            }
+            catch (const std::runtime_error &e) {
+                // the worker fails to start, and is reported as lost
+                std::cerr << e.what() << "\n";
+                _superSocket.dispose(conn);
+                continue;
+            }
+
+            Message reply;
+            reply << _testFiles << _testFileHashes;
+            reply.send(conn);
+        }
+        break;
+
+        case OpCode::FETCH_FILE: {
+            uint32_t i;
+            m >> i;
+
+            if (i >= _testFileContents.size()) {
+                _superSocket.dispose(conn);
+                continue;
+            }
+
+            Message reply;
+            reply << Message::ref(_testFileContents[i]);
+            reply.send(conn);
+        }
+        break;
+
+        case OpCode::DRIVER_FINISHED: {
+            auto it = _runs.find(id);
+            if (it == _runs.end()) return -1;
+
+            auto &run = it->second;
+            m >> run.test->_status >> run.test->_detailedReport >> run.test->_traceEvents;
+            run.test->_recvResults(0, m);
+            run.driverDone = true;
         }
         break;
 
@@ -470,7 +878,14 @@ uint32_t DriverContext::_waitForSuperEvent() {
 
 uint32_t DriverContext::_waitForEvent() {
     while (true) {
-        auto &conn = _socket.pollOrAccept();
+        auto ptr = _socket.pollOrAcceptOrTimeout(0);
+        if (ptr == nullptr) {
+            _checkHeartbeats();
+
+            ptr = _socket.pollOrAcceptOrTimeout(_heartbeatInterval);
+            if (ptr == nullptr) continue;
+        }
+        auto &conn = *ptr;
 
         Message m;
         try {
@@ -499,6 +914,28 @@ uint32_t DriverContext::_waitForEvent() {
         }
         break;
 
+        case OpCode::PEER_MESSAGE: {
+            uint32_t tag;
+            m >> tag;
+            _peerMessages.push_back({ id, tag, std::move(m) });
+        }
+        return -1;
+
+        case OpCode::HEARTBEAT: {
+            uint32_t seq;
+            bool last;
+            m >> seq >> last;
+
+            // connections left over from earlier tests may still deliver
+            // heartbeats of workers with the same id
+            if (seq != _testSeq) return -1;
+
+            _heartbeats[id] = last
+                ? std::chrono::steady_clock::time_point::max()
+                : std::chrono::steady_clock::now();
+        }
+        return -1;
+
         default: break;
         }
 
@@ -506,9 +943,192 @@ uint32_t DriverContext::_waitForEvent() {
     }
 }
 
+void DriverContext::_checkWorkers() {
+    auto now = std::chrono::steady_clock::now();
+    auto sinceLastCheck = now - _lastWorkerCheck;
+    if (sinceLastCheck < std::chrono::milliseconds(_heartbeatInterval)) return;
+    _lastWorkerCheck = now;
+
+    // workers drop heartbeats while the driver is busy elsewhere, so after a
+    // pause they get a full timeout from now
+    bool paused = sinceLastCheck > std::chrono::milliseconds(2 * _heartbeatInterval);
+
+    std::list<std::pair<uint32_t, std::string>> lost;
+
+    for (auto &w : _workers) {
+        if (_lostWorkers.count(w.first) != 0) continue;
+
+        if (w.second._pid != 0 && waitpid(w.second._pid, NULL, WNOHANG) == w.second._pid) {
+            w.second._pid = 0;
+            lost.push_back({ w.first, "exited unexpectedly" });
+            continue;
+        }
+
+        if (_heartbeatTimeout == 0 || ! w.second._running) continue;
+
+        auto it = _heartbeats.find(w.first);
+        if (it == _heartbeats.end()) continue;
+
+        if (paused) {
+            it->second = now;
+        }
+        else if (now - it->second > std::chrono::milliseconds(_heartbeatTimeout)) {
+            lost.push_back({ w.first, "stopped responding" });
+        }
+    }
+
+    for (const auto &w : lost) _workerLost(w.first, w.second);
+}
+
+void DriverContext::_checkHeartbeats() {
+    if (_heartbeatTimeout == 0) return;
+
+    auto now = std::chrono::steady_clock::now();
+
+    // as in _checkWorkers(), a driver body that did not wait on workers for a
+    // while may have missed heartbeats
+    bool paused = now - _lastHeartbeatCheck > std::chrono::milliseconds(2 * _heartbeatInterval);
+    _lastHeartbeatCheck = now;
+
+    for (const auto &w : _allocatedWorkers) {
+        auto &heartbeat = _heartbeats[w.first];
+        if (paused) {
+            if (heartbeat < now) heartbeat = now;
+        }
+        else if (now - heartbeat > std::chrono::milliseconds(_heartbeatTimeout)) {
+            // called with the sandbox locked, which the exception releases
+            char msg[64];
+            snprintf(msg, sizeof(msg), "Worker %u stopped responding", w.first);
+            throw TestFailureException(msg);
+        }
+    }
+}
+
+void DriverContext::_workerLost(uint32_t id, const std::string &reason) {
+    _lostWorkers.insert(id);
+
+    auto w = _findAllocatedWorker(id);
+    if (w != nullptr && ! w->_done) {
+        w->_done = true;
+        w->_status = Test::Status::FAIL;
+        w->_detailedReport =
+            "\"errors\": [\n"
+            + indent(jsonify("Worker " + std::to_string(id) + " " + reason), 2)
+            + "\n]";
+    }
+}
+
+void DriverContext::_replaceLostWorkers() {
+    for (auto it = _lostWorkers.begin(); it != _lostWorkers.end(); ) {
+        auto id = *it;
+
+        if (_busyWorkers.count(id) != 0) {
+            ++it;
+            continue;
+        }
+
+        auto w = _workers.find(id);
+        if (w != _workers.end()) {
+            if (w->second._pid != 0) {
+                kill(w->second._pid, SIGKILL);
+                waitpid(w->second._pid, NULL, 0);
+            }
+            _workers.erase(w);
+        }
+        _heartbeats.erase(id);
+        _clockSyncs.erase(id);
+
+        auto launched = std::find(_launchedWorkers.begin(), _launchedWorkers.end(), id);
+        if (launched != _launchedWorkers.end()) {
+            _launchedWorkers.erase(launched);
+            _launchWorker();
+        }
+
+        it = _lostWorkers.erase(it);
+    }
+
+    _socket.disposeClosed();
+    _superSocket.disposeClosed();
+}
+
+void DriverContext::_awaitWorker(uint32_t id) {
+    while (! _workers[id]._running) {
+        _waitForSuperEvent();
+
+        if (_lostWorkers.count(id) != 0) {
+            throw std::runtime_error(
+                "Worker " + std::to_string(id) + " exited before joining the driver"
+            );
+        }
+    }
+
+    _syncClock(id);
+}
+
+void DriverContext::_syncClock(uint32_t id) {
+    auto it = _clockSyncs.find(id);
+    if (it != _clockSyncs.end() && traceClock() - it->second.time < _CLOCK_SYNC_PERIOD) {
+        return;
+    }
+
+    Socket &socket = _workers[id]._socket;
+
+    ClockSync sync;
+    int64_t minRoundTrip = INT64_MAX;
+
+    // NTP-style exchange. The sample with the shortest round trip bounds the
+    // offset most tightly.
+    try {
+        for (int i = 0; i < _CLOCK_SYNC_SAMPLES; ++i) {
+            Message m;
+            m << OpCode::CLOCK_SYNC;
+
+            int64_t t0 = traceClock();
+            m.send(socket);
+
+            Message reply;
+            reply.recv(socket);
+            int64_t t3 = traceClock();
+
+            if (! reply.hasData()) return;
+
+            int64_t t1, t2;
+            reply >> t1 >> t2;
+
+            int64_t roundTrip = (t3 - t0) - (t2 - t1);
+            if (roundTrip < minRoundTrip) {
+                minRoundTrip = roundTrip;
+                sync.offset = ((t1 - t0) + (t2 - t3)) / 2;
+                sync.error = roundTrip / 2;
+            }
+        }
+    }
+    catch (...) {
+        // a worker that cannot answer is caught by the heartbeat checks
+        return;
+    }
+
+    sync.time = traceClock();
+    _clockSyncs[id] = sync;
+}
+
+DriverContext::WorkerHandle * DriverContext::_findAllocatedWorker(uint32_t id) {
+    auto it = _allocatedWorkers.find(id);
+    if (it != _allocatedWorkers.end()) return &it->second;
+
+    for (auto &run : _runs) {
+        auto it = run.second.workers.find(id);
+        if (it != run.second.workers.end()) return &it->second;
+    }
+
+    return nullptr;
+}
+
 std::list<uint32_t> DriverContext::_allocateWorkers(uint16_t n) {
     std::list<uint32_t> spawned;
 
+    _replaceLostWorkers();
+
     while (_workers.size() < n) {
         auto w = _spawnWorker();
         spawned.push_back(w._id);
@@ -518,12 +1138,11 @@ std::list<uint32_t> DriverContext::_allocateWorkers(uint16_t n) {
     for (auto &w : _workers) {
         if (n-- == 0) break;
 
-        while (! w.second._running) {
-            _waitForSuperEvent();
-        }
+        _awaitWorker(w.first);
 
         w.second._notifyCount = 0;
         w.second._done = false;
+        w.second._traceEvents.clear();
 
         _allocatedWorkers[w.second._id] = w.second;
     }
@@ -533,16 +1152,167 @@ std::list<uint32_t> DriverContext::_allocateWorkers(uint16_t n) {
 
 void DriverContext::_deallocateWorkers(std::list<uint32_t> &spawnedWorkers) {
     for (auto &w : spawnedWorkers) {
+        // lost workers are cleaned up below
+        if (_lostWorkers.count(w) != 0) continue;
+
         _allocatedWorkers[w].terminate();
         _workers.erase(w);
+        _heartbeats.erase(w);
+        _clockSyncs.erase(w);
     }
 
     _allocatedWorkers.clear();
+
+    if (! _lostWorkers.empty()) {
+        _replaceLostWorkers();
+    }
+    else if (! spawnedWorkers.empty()) {
+        _socket.disposeClosed();
+        _superSocket.disposeClosed();
+    }
+}
+
+bool DriverContext::_canLaunch(const Test *test) const {
+    if (_runs.size() >= Test::_maxConcurrentTests) return false;
+
+    uint16_t n = test->_numWorkers == 0 ? Test::_defaultNumWorkers : test->_numWorkers;
+
+    size_t spawned = 0;
+    for (const auto &run : _runs) spawned += run.second.spawnedWorkers.size();
+
+    // tests that need more workers than the pool has bring their own
+    if (n > _workers.size() - spawned) return true;
+
+    return _workers.size() - _busyWorkers.size() >= n;
+}
+
+void DriverContext::_launch(Test *test) {
+    if (test->_numWorkers == 0) test->_numWorkers = Test::_defaultNumWorkers;
+
+    _replaceLostWorkers();
+
+    uint32_t runId = _nextRunId++;
+    auto &run = _runs[runId];
+    run.test = test;
+    run.start = traceClock();
+
+    std::list<uint32_t> ids;
+    for (const auto &w : _workers) {
+        if (ids.size() == test->_numWorkers) break;
+        if (_busyWorkers.count(w.first) == 0) ids.push_back(w.first);
+    }
+    while (ids.size() < test->_numWorkers) {
+        auto w = _spawnWorker();
+        ids.push_back(w._id);
+        run.spawnedWorkers.push_back(w._id);
+    }
+    _busyWorkers.insert(ids.begin(), ids.end());
+
+    for (auto id : ids) {
+        _awaitWorker(id);
+
+        auto &w = _workers[id];
+        w._notifyCount = 0;
+        w._done = false;
+        w._traceEvents.clear();
+
+        run.workers[id] = w;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+        // the runner drives the test through its own listening socket, so
+        // that events of concurrent tests never mix. Results go back to the
+        // main driver process, which joins the workers.
+        _currentTest = test;
+        _allocatedWorkers = run.workers;
+        _runs.clear();
+
+        _socket = Socket(0, 128);
+        _runnerPort = Socket::get_port(_socket.address());
+
+        _run(test);
+        test->_driverRun();
+
+        std::stringstream s;
+        test->_report(true, s);
+
+        test->_traceEvents.clear();
+        test->_trace(true, test->_traceEvents);
+
+        Message m;
+        m << OpCode::DRIVER_FINISHED << runId << test->_status << s.str()
+            << test->_traceEvents;
+        test->_sendResults(m);
+        Socket superSocket(_superAddress);
+        m.send(superSocket);
+
+        // workers may still connect to this runner until they are done, so
+        // it lives on until the main driver process joins the test
+        while (true) pause();
+    }
+
+    run.pid = pid;
+}
+
+Test * DriverContext::_waitForConcurrentTest() {
+    while (true) {
+        for (auto it = _runs.begin(); it != _runs.end(); ++it) {
+            auto &run = it->second;
+            if (! run.driverDone) continue;
+
+            bool done = true;
+            for (const auto &w : run.workers) done = done && w.second._done;
+            if (! done) continue;
+
+            auto test = run.test;
+            auto start = run.start;
+            auto spawned = std::move(run.spawnedWorkers);
+
+            kill(run.pid, SIGKILL);
+            waitpid(run.pid, NULL, 0);
+
+            for (const auto &w : run.workers) _busyWorkers.erase(w.first);
+            _allocatedWorkers.swap(run.workers);
+            _runs.erase(it);
+
+            _join(test);
+            _deallocateWorkers(spawned);
+
+            if (! test->_joinedReport.empty()) {
+                test->_detailedReport += ",\n" + test->_joinedReport;
+            }
+
+            test->_success = test->_status == test->_expectedStatus;
+            test->_traceEvents.push_back({ "test", 0, start, traceClock() - start });
+            return test;
+        }
+
+        _waitForSuperEvent();
+    }
 }
 
 void DriverContext::_run(const Test *test) {
+    // ranks are assigned in worker id order; the driver is rank 0
+    _peerIds.clear();
+    for (const auto &w : _allocatedWorkers) _peerIds.push_back(w.first);
+    std::sort(_peerIds.begin(), _peerIds.end());
+
+    _peerAddrs.clear();
+    for (auto id : _peerIds) _peerAddrs.push_back(_allocatedWorkers[id]._addr);
+
+    _collectiveTag = 0;
+    _peerMessages.clear();
+
+    ++_testSeq;
+
+    auto now = std::chrono::steady_clock::now();
     for (auto &w : _allocatedWorkers) {
-        w.second.run(test);
+        _heartbeats[w.first] = now;
+        w.second.run(test, _peerIds, _peerAddrs);
     }
 }
 
@@ -558,7 +1328,19 @@ void DriverContext::_join(Test *test) {
 
         test->_childStatus.push_back(w.second._status);
         test->_childDetailedReport.push_back(w.second._detailedReport);
+        test->_traceEvents.insert(
+            test->_traceEvents.end(),
+            w.second._traceEvents.begin(),
+            w.second._traceEvents.end()
+        );
+
+        // lost workers have no results
+        if (w.second._results.hasData()) test->_recvResults(w.first, w.second._results);
     }
+
+    std::stringstream s;
+    test->_joinResults(s);
+    test->_joinedReport = s.str();
 }
 
 void DriverContext::setAddress(const char *address) {
@@ -603,6 +1385,29 @@ Message DriverContext::getUserMessage() {
     return m;
 }
 
+Message DriverContext::_createPeerMessage(uint32_t tag) {
+    sandbox().lock();
+
+    Message m;
+    m << OpCode::PEER_MESSAGE << 0u << tag;
+
+    sandbox().unlock();
+
+    return m;
+}
+
+void DriverContext::_sendToPeer(uint32_t rank, Message &message) {
+    sandbox().lock();
+
+    message.send(_allocatedWorkers[_peerIds[rank - 1]]._socket);
+
+    sandbox().unlock();
+}
+
+void DriverContext::_waitForPeerEvent() {
+    _waitForEvent();
+}
+
 void DriverContext::notify() {
     sandbox().lock();
 
@@ -655,11 +1460,141 @@ void WorkerContext::_start(uint32_t id) {
     _id = id;
 
     _socket = Socket(0, 128);
-    auto superDriverSocket = Socket(DriverContext::instance->_superAddress);
+    _driverSocket = Socket(DriverContext::instance->_address);
+    _superDriverSocket = Socket(DriverContext::instance->_superAddress);
 
     Message m;
     m << OpCode::WORKER_STARTED << _id << _socket.address();
-    m.send(superDriverSocket);
+    m.send(_superDriverSocket);
+
+    _startHeartbeat();
+}
+
+void WorkerContext::_startHeartbeat() {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw std::runtime_error(std::string("Failed to create pipe. ") + strerror(errno));
+    }
+
+    pid_t parent = getpid();
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != parent) _exit(0);
+
+        signal(SIGPIPE, SIG_IGN);
+        for (int fd = getdtablesize(); fd > 2; --fd) {
+            if (fd != fds[0]) close(fd);
+        }
+
+        _heartbeat(fds[0]);
+    }
+
+    close(fds[0]);
+    _heartbeatPipe = fds[1];
+}
+
+// Heartbeats that cannot be sent right away are dropped, so their sockets only
+// need room for a few, and a busy receiver finds fresh ones rather than a
+// backlog.
+static const int HEARTBEAT_BUFFER_SIZE = 4096;
+
+struct HeartbeatTarget {
+    sockaddr addr;
+    uint32_t testSeq;
+};
+
+// Runs in a separate process so that heartbeats keep flowing while test
+// bodies block the worker, and stop as soon as the worker dies.
+void WorkerContext::_heartbeat(int pipeFd) {
+    try {
+        Socket driver(DriverContext::instance->_superAddress);
+        driver.setSendBufferSize(HEARTBEAT_BUFFER_SIZE);
+        Socket target;
+        uint32_t testSeq = 0;
+
+        // the driver side of the previous test, until it has been told that
+        // this worker is done
+        Socket finished;
+        Message last;
+
+        Message m;
+        m << OpCode::HEARTBEAT << _id << testSeq << false;
+
+        pollfd pfd = { pipeFd, POLLIN, 0 };
+
+        while (true) {
+            if (poll(&pfd, 1, DriverContext::instance->_heartbeatInterval) > 0) {
+                HeartbeatTarget t;
+                if (read(pipeFd, &t, sizeof(t)) != sizeof(t)) break;
+
+                if (target.valid()) {
+                    last = Message();
+                    last << OpCode::HEARTBEAT << _id << testSeq << true;
+                    finished = std::move(target);
+                }
+
+                try {
+                    target = (t.addr.sa_family == AF_UNSPEC) ? Socket() : Socket(t.addr);
+                    if (target.valid()) target.setSendBufferSize(HEARTBEAT_BUFFER_SIZE);
+                }
+                catch (...) {
+                    target = Socket();
+                }
+
+                testSeq = t.testSeq;
+                m = Message();
+                m << OpCode::HEARTBEAT << _id << testSeq << false;
+            }
+
+            // A receiver that is busy (such as the driver process while it
+            // runs the driver side of a test) lets its socket fill up.
+            // Heartbeats are then dropped rather than waited on, so that the
+            // others keep flowing. Only the last one of a test is kept until
+            // it can be sent.
+            try {
+                if (finished.valid() && finished.writable()) {
+                    last.send(finished);
+                    finished = Socket();
+                }
+            }
+            catch (...) {
+                finished = Socket();
+            }
+
+            if (driver.writable()) m.send(driver);
+
+            // the driver side of a test is not listening to the super socket,
+            // so it gets its own heartbeats
+            try {
+                if (target.valid() && target.writable()) m.send(target);
+            }
+            catch (...) {
+                target = Socket();
+            }
+        }
+    }
+    catch (...) { }
+
+    _exit(0);
+}
+
+void WorkerContext::_setHeartbeatTarget(const sockaddr *addr, uint32_t testSeq) {
+    HeartbeatTarget t;
+    if (addr != nullptr) {
+        t.addr = *addr;
+    }
+    else {
+        t.addr.sa_family = AF_UNSPEC;
+    }
+    t.testSeq = testSeq;
+
+    if (write(_heartbeatPipe, &t, sizeof(t)) == -1) {
+        throw std::runtime_error(
+            std::string("Failed to reach heartbeat process. ") + strerror(errno)
+        );
+    }
 }
 
 void WorkerContext::_waitForEvent() {
@@ -687,7 +1622,19 @@ void WorkerContext::_waitForEvent() {
             std::string module;
             std::string name;
 
-            m >> module >> name;
+            uint16_t runnerPort;
+            uint32_t testSeq;
+            m >> module >> name >> _peerIds >> _peerAddrs >> runnerPort >> testSeq;
+
+            auto driverAddr = DriverContext::instance->_address;
+            if (runnerPort != 0) {
+                driverAddr = Socket::set_port(driverAddr, runnerPort);
+                _runnerSocket = Socket(driverAddr);
+            }
+            _setHeartbeatTarget(&driverAddr, testSeq);
+
+            _peerRank = std::find(_peerIds.begin(), _peerIds.end(), _id)
+                - _peerIds.begin() + 1;
 
             auto it = std::find_if(
                 Test::__tests[module].begin(),
@@ -699,12 +1646,21 @@ void WorkerContext::_waitForEvent() {
                 Test *t = (*it)->copy();
                 t->_run();
 
-                auto superDriverSocket = Socket(DriverContext::instance->_superAddress);
                 Message m;
-                m << OpCode::FINISHED_TEST << _id << t->_status << t->_detailedReport;
-                m.send(superDriverSocket);
+                m << OpCode::FINISHED_TEST << _id << t->_status << t->_detailedReport
+                    << t->_traceEvents;
+                t->_sendResults(m);
+                m.send(_superDriverSocket);
             }
 
+            // peers may already be talking about the next test, so leftover
+            // state is only dropped once this one is over
+            _collectiveTag = 0;
+            _peerMessages.clear();
+            _peerSockets.clear();
+            _runnerSocket = Socket();
+            _setHeartbeatTarget(nullptr);
+
             _inTest = false;
         }
         break;
@@ -714,6 +1670,15 @@ void WorkerContext::_waitForEvent() {
         }
         break;
 
+        case OpCode::CLOCK_SYNC: {
+            int64_t received = traceClock();
+
+            Message reply;
+            reply << received << traceClock();
+            reply.send(conn);
+        }
+        break;
+
         case OpCode::TERMINATE: {
             exit(0);
         }
@@ -724,6 +1689,13 @@ void WorkerContext::_waitForEvent() {
         }
         break;
 
+        case OpCode::PEER_MESSAGE: {
+            uint32_t src, tag;
+            m >> src >> tag;
+            _peerMessages.push_back({ src, tag, std::move(m) });
+        }
+        break;
+
         default: break;
         }
 
@@ -742,13 +1714,15 @@ Message WorkerContext::createUserMessage() {
     return m;
 }
 
+void WorkerContext::_sendToDriver(Message &message) {
+    std::lock_guard<std::mutex> guard(_driverSocketMtx);
+    message.send(_runnerSocket.valid() ? _runnerSocket : _driverSocket);
+}
+
 void WorkerContext::sendUserMessage(Message &message) {
     sandbox().lock();
 
-    {
-        auto driverSocket = Socket(DriverContext::instance->_address);
-        message.send(driverSocket);
-    }
+    _sendToDriver(message);
 
     sandbox().unlock();
 }
@@ -759,7 +1733,7 @@ Message WorkerContext::getUserMessage() {
     while (_userMessages.empty()) {
         _waitForEvent();
     }
-    Message m = _userMessages.front();
+    Message m = std::move(_userMessages.front());
     _userMessages.pop_front();
 
     sandbox().unlock();
@@ -767,14 +1741,45 @@ Message WorkerContext::getUserMessage() {
     return m;
 }
 
+Message WorkerContext::_createPeerMessage(uint32_t tag) {
+    sandbox().lock();
+
+    Message m;
+    m << OpCode::PEER_MESSAGE << _peerRank << tag;
+
+    sandbox().unlock();
+
+    return m;
+}
+
+void WorkerContext::_sendToPeer(uint32_t rank, Message &message) {
+    sandbox().lock();
+
+    if (rank == 0) {
+        _sendToDriver(message);
+    }
+    else {
+        auto it = _peerSockets.find(rank);
+        if (it == _peerSockets.end()) {
+            it = _peerSockets.emplace(rank, Socket(_peerAddrs[rank - 1])).first;
+        }
+        message.send(it->second);
+    }
+
+    sandbox().unlock();
+}
+
+void WorkerContext::_waitForPeerEvent() {
+    _waitForEvent();
+}
+
 void WorkerContext::notify() {
     sandbox().lock();
 
     {
-        auto driverSocket = Socket(DriverContext::instance->_address);
         Message m;
         m << OpCode::NOTIFY << _id;
-        m.send(driverSocket);
+        _sendToDriver(m);
     }
 
     sandbox().unlock();
@@ -794,4 +1799,93 @@ void WorkerContext::wait(uint32_t n) {
     sandbox().unlock();
 }
 
+static bool readFile(const std::string &path, Buffer &content) {
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    if (! f.is_open()) return false;
+
+    content = Buffer((size_t) f.tellg());
+    f.seekg(0);
+    return (bool) f.read((char *) content.data(), content.size());
+}
+
+std::vector<std::string> WorkerContext::fetchTests(
+    uint32_t id,
+    const std::string &cacheDir
+) {
+    // cached files are loaded into the worker, so no one else may be able to
+    // place or replace them
+    if (mkdir(cacheDir.c_str(), 0700) != 0 && errno != EEXIST) {
+        throw std::runtime_error(
+            "Failed to create cache directory " + cacheDir + ". " + strerror(errno)
+        );
+    }
+
+    struct stat st;
+    if (
+        lstat(cacheDir.c_str(), &st) != 0
+        || ! S_ISDIR(st.st_mode)
+        || st.st_uid != getuid()
+        || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0
+    ) {
+        throw std::runtime_error(
+            "Cache directory " + cacheDir + " must be a directory owned by the current user and writable by no one else"
+        );
+    }
+
+    Socket driver(DriverContext::instance->_superAddress);
+
+    Message request;
+    request << OpCode::FETCH_TESTS << id;
+    request.send(driver);
+
+    std::vector<std::string> names;
+    std::vector<std::string> hashes;
+    Message manifest;
+    manifest.recv(driver) >> names >> hashes;
+
+    if (hashes.size() != names.size()) throw std::runtime_error("Invalid test file list");
+
+    std::vector<std::string> paths;
+
+    for (uint32_t i = 0; i < names.size(); ++i) {
+        if (hashes[i].size() != 64 || hashes[i].find_first_not_of("0123456789abcdef") != std::string::npos) {
+            throw std::runtime_error("Invalid hash of test file " + names[i]);
+        }
+
+        auto path = cacheDir + "/" + hashes[i] + ".dtest.so";
+
+        // cached files are verified on every use, not only when fetched
+        Buffer content;
+        if (readFile(path, content) && sha256(content.data(), content.size()) == hashes[i]) {
+            paths.push_back(path);
+            continue;
+        }
+
+        Message request;
+        request << OpCode::FETCH_FILE << id << i;
+        request.send(driver);
+
+        Message reply;
+        reply.recv(driver) >> content;
+
+        if (sha256(content.data(), content.size()) != hashes[i]) {
+            throw std::runtime_error("Corrupted test file " + names[i]);
+        }
+
+        // other workers on this host may be fetching the same file
+        auto tmp = path + "." + std::to_string(getpid());
+        std::ofstream f(tmp, std::ios::binary);
+        f.write((const char *) content.data(), content.size());
+        f.close();
+        if (! f) throw std::runtime_error("Failed to write " + tmp);
+        if (rename(tmp.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Failed to write " + path + ". " + strerror(errno));
+        }
+
+        paths.push_back(path);
+    }
+
+    return paths;
+}
+
 Lazy<WorkerContext> WorkerContext::instance([] { return new WorkerContext(); });
@@ -7,13 +7,91 @@
 
 #include <chrono>
 
-uint64_t dtest::timeOf(const std::function<void()> &func) {
-    auto start = std::chrono::high_resolution_clock::now();
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#define DTEST_HAS_TSC
+#endif
+
+static bool calibrated = false;
+static bool useTsc = false;
+static uint64_t tscBase = 0;
+static double nanosPerTick = 1;
+static uint64_t overhead = 0;
+
+static inline uint64_t steadyNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+#ifdef DTEST_HAS_TSC
+static inline uint64_t readTsc() {
+    unsigned int aux;
+    _mm_lfence();
+    uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+}
+
+static bool invariantTsc() {
+    unsigned int a, b, c, d;
+    if (! __get_cpuid(0x80000007, &a, &b, &c, &d)) return false;
+    return (d >> 8) & 1;
+}
+#endif
+
+void dtest::calibratePreciseClock() {
+    calibrated = true;
+
+#ifdef DTEST_HAS_TSC
+    if (invariantTsc()) {
+        uint64_t start = steadyNow();
+        uint64_t tscStart = readTsc();
+        while (steadyNow() - start < 10000000);     // 10 ms
+        uint64_t end = steadyNow();
+        uint64_t tscEnd = readTsc();
 
-    if (func) func();
+        if (tscEnd > tscStart) {
+            useTsc = true;
+            tscBase = tscStart;
+            nanosPerTick = (double) (end - start) / (tscEnd - tscStart);
+        }
+    }
+#endif
+
+    // the cheapest of many timings of an empty body
+    std::function<void()> empty = [] { };
+    overhead = -1lu;
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t start = preciseClock();
+        empty();
+        uint64_t time = preciseClock() - start;
+        if (time < overhead) overhead = time;
+    }
+}
+
+uint64_t dtest::preciseClock() {
+    if (! calibrated) calibratePreciseClock();
+
+#ifdef DTEST_HAS_TSC
+    if (useTsc) return (readTsc() - tscBase) * nanosPerTick;
+#endif
+
+    return steadyNow();
+}
+
+uint64_t dtest::timerOverhead() {
+    if (! calibrated) calibratePreciseClock();
+    return overhead;
+}
+
+uint64_t dtest::timeOf(const std::function<void()> &func) {
+    if (! func) return 0;
 
-    auto end = std::chrono::high_resolution_clock::now();
-    if (! func) end = start;
+    uint64_t start = preciseClock();
+    func();
+    uint64_t time = preciseClock() - start;
 
-    return (end - start).count();
+    return time > overhead ? time - overhead : 0;
 }
@@ -6,11 +6,32 @@
 #include <dtest_core/unit_test.h>
 #include <dtest_core/util.h>
 #include <dtest_core/time_of.h>
+#include <dtest_core/affinity.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sys/stat.h>
 
 using namespace dtest;
 
 void UnitTest::_configure() {
     sandbox().disableFaultyNetwork();
+
+    // an in-process sandbox would pin the driver itself for good
+    if (! _inProcessSandbox && (! _cpus.empty() || _numaNode >= 0)) {
+        setAffinity(_cpus, _numaNode);
+    }
+}
+
+uint64_t UnitTest::_timeOf(const std::function<void()> &func, CounterValues &counters) {
+    PerfCounters c(_perfCounters);
+
+    c.start();
+    auto time = timeOf(func);
+    c.stop();
+    c.addTo(counters);
+
+    return time;
 }
 
 void UnitTest::_checkMemoryLeak() {
@@ -64,12 +85,19 @@ void UnitTest::_driverRun() {
             _status = Status::FAIL;
 
             if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
+            _initStart = traceClock();
             _initTime = timeOf(_onInit);
 
             if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
-            _bodyTime = timeOf(_body);
+            _bodyStart = traceClock();
+            if (_profile) Profiler::start();
+            auto allocated = sandbox().allocated();
+            _bodyTime = _timeOf(_body, _bodyCounters);
+            _bodyAllocations.add(allocated, sandbox().allocated(), 1);
+            if (_profile) Profiler::stop();
             if (_resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
 
+            _completeStart = traceClock();
             _completeTime = timeOf(_onComplete);
             if (! _resourceSnapshotBodyOnly) sandbox().resourceSnapshot(_usedResources);
 
@@ -78,13 +106,22 @@ void UnitTest::_driverRun() {
         [this] (Message &m) {
             _checkMemoryLeak();
             _checkTimeout(_bodyTime);
+            if (_profile) _profileStacks = Profiler::collect();
 
             m << _status
                 << _usedResources
                 << _errors
                 << _initTime
                 << _bodyTime
-                << _completeTime;
+                << _completeTime
+                << _initStart
+                << _bodyStart
+                << _completeStart
+                << _bodyCounters
+                << _itemsProcessed
+                << _bytesProcessed
+                << _bodyAllocations
+                << _profileStacks;
         },
         [this] (Message &m) {
             m >> _status
@@ -92,7 +129,15 @@ void UnitTest::_driverRun() {
                 >> _errors
                 >> _initTime
                 >> _bodyTime
-                >> _completeTime;
+                >> _completeTime
+                >> _initStart
+                >> _bodyStart
+                >> _completeStart
+                >> _bodyCounters
+                >> _itemsProcessed
+                >> _bytesProcessed
+                >> _bodyAllocations
+                >> _profileStacks;
         },
         [this] (const std::string &error) {
             _status = Status::FAIL;
@@ -105,6 +150,50 @@ void UnitTest::_driverRun() {
     _err = std::move(opt.error());
 
     if (! finish) _status = Status::TIMEOUT;
+
+    _saveProfile();
+}
+
+void UnitTest::_saveProfile() {
+    // already saved, or nothing to save
+    if (_profileStacks.empty() || ! _profileFile.empty()) return;
+
+    auto name = _module + "::" + _name;
+    std::replace(name.begin(), name.end(), '/', '_');
+
+    mkdir("dtest.profile", 0755);
+    _profileFile = "dtest.profile/" + name + ".folded";
+
+    std::ofstream f(_profileFile, std::ios_base::out | std::ios_base::trunc);
+    f << _profileStacks;
+
+    if (! f.good()) {
+        _errors.push_back("WARNING - failed to write profile to " + _profileFile);
+        _profileFile.clear();
+    }
+}
+
+std::string UnitTest::_profileReport() {
+    auto samples = profileSamples(_profileStacks);
+
+    std::stringstream s;
+    s << "\"samples\": " << samples;
+    if (! _profileFile.empty()) {
+        s << ",\n\"file\": " << jsonify(_profileFile);
+    }
+    s << ",\n\"hot\": [";
+
+    bool first = true;
+    for (const auto &f : hotFrames(_profileStacks, 10)) {
+        if (! first) s << ",";
+        s << "\n  { \"frame\": " << jsonify(f.frame)
+            << ", \"samples\": " << f.samples
+            << ", \"percent\": " << 100.0 * f.samples / samples << " }";
+        first = false;
+    }
+    s << "\n]";
+
+    return s.str();
 }
 
 bool UnitTest::_hasMemoryReport() {
@@ -144,6 +233,21 @@ std::string UnitTest::_memoryReport() {
     return s.str();
 }
 
+std::string UnitTest::_counterReport(const CounterValues &counters) {
+    std::stringstream s;
+
+    bool first = true;
+    for (int i = 0; i < CounterValues::COUNT; ++i) {
+        if (counters.value[i] < 0) continue;
+
+        if (! first) s << ",\n";
+        s << "\"" << CounterValues::name((Counter) i) << "\": " << counters.value[i];
+        first = false;
+    }
+
+    return s.str();
+}
+
 void UnitTest::_report(bool driver, std::stringstream &s) {
     if (! _errors.empty()) {
         s << _errorReport() << ",\n";
@@ -159,6 +263,15 @@ void UnitTest::_report(bool driver, std::stringstream &s) {
     }
     s << "\n}";
 
+    auto counters = _counterReport(_bodyCounters);
+    if (! counters.empty()) {
+        s << ",\n\"counters\": {\n" << indent(counters, 2) << "\n}";
+    }
+
+    if (_profile) {
+        s << ",\n\"profile\": {\n" << indent(_profileReport(), 2) << "\n}";
+    }
+
     if (_hasMemoryReport()) {
         s << ",\n\"memory\": {\n" << indent(_memoryReport(), 2) << "\n}";
     }
@@ -171,3 +284,9 @@ void UnitTest::_report(bool driver, std::stringstream &s) {
         s << ",\n\"stderr\": \n" << indent(jsonify(std::string((const char *) _err.data(), _err.size())), 2);
     }
 }
+
+void UnitTest::_trace(bool driver, std::vector<TraceEvent> &events) {
+    if (_initTime > 0) events.push_back({ "initialization", 0, _initStart, (int64_t) _initTime });
+    if (_bodyStart > 0) events.push_back({ "body", 0, _bodyStart, (int64_t) _bodyTime });
+    if (_completeTime > 0) events.push_back({ "cleanup", 0, _completeStart, (int64_t) _completeTime });
+}
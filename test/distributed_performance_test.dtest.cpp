@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2021 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+
+module("distributed-performance-test")
+.dependsOn({
+    "unit-test"
+});
+
+dperf("distributed-performance-test", "pass")
+.workers(2)
+.driver([] {
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
+})
+.worker([] {
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
+    dtest_set_items_processed(1000000);
+})
+.baseline([] {
+    for (int i = 0; i < 8000000; ++i) dtest_do_not_optimize(i);
+})
+.workerBaseline([] {
+    for (int i = 0; i < 8000000; ++i) dtest_do_not_optimize(i);
+});
+
+dperf("distributed-performance-test", "too-slow")
+.workers(2)
+.expect(Status::TOO_SLOW)
+.driver([] { })
+.worker([] {
+    for (int i = 0; i < 8000000; ++i) dtest_do_not_optimize(i);
+})
+.workerBaseline([] {
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
+});
+
+static uint32_t slowWorker = 0;
+
+dperf("distributed-performance-test", "too-slow-worker")
+.workers(2)
+.expect(Status::TOO_SLOW)
+.onInit([] {
+    auto ids = dtest_gather(dtest_worker_id());
+    if (! ids.empty()) slowWorker = ids.front();
+    dtest_broadcast(slowWorker);
+})
+.driver([] { })
+.worker([] {
+    // one slow worker holds back the whole run
+    if (dtest_worker_id() == slowWorker) {
+        for (int i = 0; i < 80000000; ++i) dtest_do_not_optimize(i);
+    }
+})
+.workerBaseline([] {
+    for (int i = 0; i < 4000000; ++i) dtest_do_not_optimize(i);
+});
+
+dperf("distributed-performance-test", "throughput")
+.workers(2)
+.driver([] {
+    dtest_set_items_processed(10);
+})
+.worker([] {
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
+    dtest_set_items_processed(1000);
+    dtest_set_bytes_processed(1000 * 4096);
+});
@@ -5,6 +5,8 @@
 
 #include <dtest.h>
 #include <thread>
+#include <algorithm>
+#include <signal.h>
 #include <dtest_core/socket.h>
 
 module("distributed-unit-test")
@@ -47,6 +49,29 @@ dunit("distributed-unit-test", "worker-fail")
     fail("test_failed");
 });
 
+dunit("distributed-unit-test", "lost-worker")
+.expect(Status::FAIL)
+.workers(2)
+.driver([] {
+    dtest_wait(2);
+})
+.worker([] {
+    // take down the worker process itself, not just the sandbox running this body
+    kill(getppid(), SIGKILL);
+});
+
+// outlasts the socket buffers that hold heartbeats the driver is not reading
+dunit("distributed-unit-test", "long-driver-body")
+.workers(2)
+.driver([] {
+    std::this_thread::sleep_for(std::chrono::seconds(4));
+    dtest_wait(2);
+})
+.worker([] {
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+    dtest_notify();
+});
+
 dunit("distributed-unit-test", "mem-leak")
 .expect(Status::PASS_WITH_MEMORY_LEAK)
 .driver([] {
@@ -148,6 +173,158 @@ dunit("distributed-unit-test", "user-message")
     dtest_send_msg(x);
 });
 
+dunit("distributed-unit-test", "large-user-message")
+.workers(2)
+.driver([] {
+    std::string s(100000, 'x');
+    std::vector<int> v(50000);
+    for (size_t i = 0; i < v.size(); ++i) v[i] = i;
+    typedef std::array<int, 2048> Ints;
+    dtest_send_msg(dtest_ref(s) << dtest_ref(v) << std::string(8192, 'y') << Ints());
+
+    for (auto i = 0; i < 2; ++i) {
+        size_t sum;
+        dtest_recv_msg(sum);
+        assert (sum == 100000 + 8192 + 50000lu * 49999 / 2);
+    }
+})
+.worker([] {
+    std::string s, t;
+    std::vector<int> v;
+    std::array<int, 2048> a;
+    dtest_recv_msg(s >> v >> t >> a);
+    assert (s == std::string(100000, 'x'));
+    assert (t == std::string(8192, 'y'));
+    for (auto x : a) assert (x == 0);
+
+    size_t sum = s.size() + t.size();
+    for (auto x : v) sum += x;
+    dtest_send_msg(sum);
+});
+
+dunit("distributed-unit-test", "structured-user-message")
+.workers(1)
+.driver([] {
+    std::string s("a\0b", 3);
+    std::array<double, 3> a = {{ 1.5, 2.5, 3.5 }};
+    std::vector<std::vector<std::string>> v = { { "x", "y" }, { }, { s } };
+    std::vector<bool> b = { true, false, true };
+    dtest_send_msg(s << a << v << b);
+})
+.worker([] {
+    std::string s;
+    std::array<double, 3> a;
+    std::vector<std::vector<std::string>> v;
+    std::vector<bool> b;
+    dtest_recv_msg(s >> a >> v >> b);
+
+    assert (s.size() == 3 && s[1] == '\0');
+    assert (a[0] == 1.5 && a[2] == 3.5);
+    assert (v.size() == 3 && v[0][1] == "y" && v[1].empty() && v[2][0] == s);
+    assert (b.size() == 3 && b[0] && ! b[1] && b[2]);
+});
+
+dunit("distributed-unit-test", "barrier")
+.workers(5)
+.driver([] {
+    for (auto i = 0; i < 3; ++i) dtest_barrier();
+})
+.worker([] {
+    for (auto i = 0; i < 3; ++i) dtest_barrier();
+});
+
+dunit("distributed-unit-test", "broadcast")
+.workers(5)
+.driver([] {
+    std::string s = "hello";
+    dtest_broadcast(s);
+
+    int x;
+    dtest_recv_msg(x);
+    for (auto i = 1; i < 5; ++i) {
+        int y;
+        dtest_recv_msg(y);
+        x += y;
+    }
+    assert (x == 5);
+})
+.worker([] {
+    std::string s;
+    dtest_broadcast(s);
+    dtest_send_msg((s == "hello" ? 1 : 0));
+});
+
+dunit("distributed-unit-test", "gather")
+.workers(5)
+.driver([] {
+    auto ids = dtest_gather(dtest_worker_id());
+    assert (ids.size() == 5);
+    for (size_t i = 1; i < ids.size(); ++i) assert (ids[i - 1] < ids[i]);
+
+    auto names = dtest_gather(std::string());
+    assert (names.size() == 5);
+    for (size_t i = 0; i < names.size(); ++i) {
+        assert (names[i] == "worker-" + std::to_string(ids[i]));
+    }
+})
+.worker([] {
+    auto ids = dtest_gather(dtest_worker_id());
+    assert (ids.empty());
+
+    dtest_gather("worker-" + std::to_string(dtest_worker_id()));
+});
+
+dunit("distributed-unit-test", "reduce")
+.workers(5)
+.driver([] {
+    auto sum = dtest_reduce(0, [] (int a, int b) { return a + b; });
+    assert (sum == 5);
+
+    auto max = dtest_reduce(0u, [] (uint32_t a, uint32_t b) { return a > b ? a : b; });
+    auto ids = dtest_gather(0u);
+    assert (max == ids.back());
+})
+.worker([] {
+    dtest_reduce(1, [] (int a, int b) { return a + b; });
+    dtest_reduce(dtest_worker_id(), [] (uint32_t a, uint32_t b) { return a > b ? a : b; });
+    dtest_gather(dtest_worker_id());
+});
+
+dunit("distributed-unit-test", "send-to-recv-from")
+.workers(4)
+.driver([] {
+    auto ids = dtest_gather(0u);
+    dtest_broadcast(ids);
+
+    for (auto id : ids) dtest_send_to(id, std::string("from driver"));
+
+    for (auto id : ids) {
+        uint32_t next;
+        dtest_recv_from(id, next);
+        assert (next == ids[(std::find(ids.begin(), ids.end(), id) - ids.begin() + 1) % ids.size()]);
+    }
+})
+.worker([] {
+    std::vector<uint32_t> ids;
+    dtest_gather(dtest_worker_id());
+    dtest_broadcast(ids);
+
+    auto i = std::find(ids.begin(), ids.end(), dtest_worker_id()) - ids.begin();
+    auto next = ids[(i + 1) % ids.size()];
+    auto prev = ids[(i + ids.size() - 1) % ids.size()];
+
+    std::string s;
+    dtest_recv_from(0, s);
+    assert (s == "from driver");
+
+    std::vector<int> v(10000, dtest_worker_id());
+    dtest_send_to(next, v);
+    dtest_recv_from(prev, v);
+    assert (v.size() == 10000 && v[0] == (int) prev);
+
+    dtest_send_to(0, next);
+});
+
 static int tcp_server_sock() {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     assert(fd != -1);
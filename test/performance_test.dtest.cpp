@@ -4,6 +4,16 @@
 */
 
 #include <dtest.h>
+#include <dtest_core/affinity.h>
+#include <dtest_core/history.h>
+#include <dtest_core/profiler.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sys/wait.h>
+#include <unistd.h>
 
 module("performance-test")
 .dependsOn({
@@ -12,46 +22,499 @@ module("performance-test")
 
 perf("performance-test", "pass")
 .body([] {
-    for (int i = 0; i < 1000000; ++i);
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
 })
 .baseline([] {
-    for (int i = 0; i < 8000000; ++i);
+    for (int i = 0; i < 8000000; ++i) dtest_do_not_optimize(i);
 });
 
 perf("performance-test", "too-slow")
 .expect(Status::TOO_SLOW)
 .body([] {
-    for (int i = 0; i < 8000000; ++i);
+    for (int i = 0; i < 8000000; ++i) dtest_do_not_optimize(i);
 })
 .baseline([] {
-    for (int i = 0; i < 1000000; ++i);
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
 });
 
 perf("performance-test", "pass-ratio")
 .performanceMarginAsBaselineRatio(0.7)
 .body([] {
-    for (int i = 0; i < 20000000; ++i);
+    for (int i = 0; i < 20000000; ++i) dtest_do_not_optimize(i);
 })
 .baseline([] {
-    for (int i = 0; i < 80000000; ++i);
+    for (int i = 0; i < 80000000; ++i) dtest_do_not_optimize(i);
 });
 
 perf("performance-test", "too-slow-ratio")
 .performanceMarginAsBaselineRatio(0.7)
 .expect(Status::TOO_SLOW)
 .body([] {
-    for (int i = 0; i < 80000000; ++i);
+    for (int i = 0; i < 80000000; ++i) dtest_do_not_optimize(i);
 })
 .baseline([] {
-    for (int i = 0; i < 20000000; ++i);
+    for (int i = 0; i < 20000000; ++i) dtest_do_not_optimize(i);
 });
 
 perf("performance-test", "error-msg")
 .expect(Status::TOO_SLOW)
 .body([] {
-    for (int i = 0; i < 8000000; ++i);
+    for (int i = 0; i < 8000000; ++i) dtest_do_not_optimize(i);
     err("error from body");
 })
 .baseline([] {
     err("error from baseline");
 });
+
+perf("performance-test", "samples-pass")
+.samples(15)
+.warmup(2)
+.performanceMarginAsBaselineRatio(0.5)
+.body([] {
+    for (int i = 0; i < 10000; ++i) dtest_do_not_optimize(i);
+})
+.baseline([] {
+    for (int i = 0; i < 800000; ++i) dtest_do_not_optimize(i);
+});
+
+perf("performance-test", "samples-too-slow")
+.samples(15)
+.expect(Status::TOO_SLOW)
+.performanceMarginAsBaselineRatio(0.5)
+.body([] {
+    for (int i = 0; i < 800000; ++i) dtest_do_not_optimize(i);
+})
+.baseline([] {
+    for (int i = 0; i < 100000; ++i) dtest_do_not_optimize(i);
+});
+
+// two samples can never be significantly different
+perf("performance-test", "samples-too-few")
+.samples(2)
+.expect(Status::FAIL)
+.body([] {
+    for (int i = 0; i < 100000; ++i) dtest_do_not_optimize(i);
+})
+.baseline([] {
+    for (int i = 0; i < 800000; ++i) dtest_do_not_optimize(i);
+});
+
+// the same code for both, so that its placement cannot make either faster
+static void equalWork() {
+    for (int i = 0; i < 100000; ++i) dtest_do_not_optimize(i);
+}
+
+perf("performance-test", "samples-equal")
+.samples(15)
+.significance(0.001)
+.expect(Status::TOO_SLOW)
+.performanceMarginNanos(0)
+.body(equalWork)
+.baseline(equalWork);
+
+static char pages[8 << 20];
+
+perf("performance-test", "counters")
+.maxCounterRatio(Counter::PAGE_FAULTS, 0.5)
+.body([] {
+    memset(pages, 1, 64 << 10);
+})
+.baseline([] {
+    memset(pages, 1, sizeof(pages));
+});
+
+perf("performance-test", "counters-too-many")
+.expect(Status::TOO_SLOW)
+.maxCounterRatio(Counter::PAGE_FAULTS, 0.5)
+.body([] {
+    memset(pages, 1, sizeof(pages));
+})
+.baseline([] {
+    for (int i = 0; i < 80000000; ++i) dtest_do_not_optimize(i);
+});
+
+perf("performance-test", "range")
+.range(1 << 10, 1 << 20, 4)
+.samples(15)
+.minSampleTimeMicros(100)
+.expectComplexity(Complexity::LINEAR)
+.performanceMarginAsBaselineRatio(0.5)
+.body([] {
+    for (uint64_t i = 0; i < dtest_input_size(); ++i) dtest_do_not_optimize(i);
+})
+.baseline([] {
+    for (uint64_t i = 0; i < 16 * dtest_input_size(); ++i) dtest_do_not_optimize(i);
+});
+
+perf("performance-test", "range-quadratic")
+.range(1 << 4, 1 << 8)
+.samples(15)
+.minSampleTimeMicros(100)
+.expectComplexity(Complexity::LINEAR)
+.expect(Status::TOO_SLOW)
+.body([] {
+    for (uint64_t i = 0; i < dtest_input_size(); ++i) {
+        for (uint64_t j = 0; j < dtest_input_size(); ++j) dtest_do_not_optimize(j);
+    }
+});
+
+// one sample at each size cannot be judged
+perf("performance-test", "range-too-few")
+.range(1 << 6, 1 << 10)
+.expectComplexity(Complexity::LINEAR)
+.expect(Status::FAIL)
+.body([] {
+    for (uint64_t i = 0; i < dtest_input_size(); ++i) dtest_do_not_optimize(i);
+});
+
+unit("performance-test", "change-point")
+.body([] {
+    std::vector<double> x(20, 100);
+    for (size_t i = 0; i < x.size(); ++i) x[i] += i % 3;
+    assert(dtest::lastChangePoint(x) == 0);
+
+    for (size_t i = 12; i < x.size(); ++i) x[i] += 50;
+    assert(dtest::lastChangePoint(x) == 12);
+});
+
+unit("performance-test", "sign-test")
+.body([] {
+    assert(dtest::signTestMinSamples(0.05) == 5);
+    assert(dtest::signTestGreater({ 1.9, 2.1, 1.8, 2.0, 1.7 }, 1.5) < 0.05);
+    assert(dtest::signTestGreater({ 1.9, 2.1, 1.4, 2.0, 1.7 }, 1.5) >= 0.05);
+    assert(dtest::signTestGreater({ 1.0, 1.1, 0.9, 1.0, 1.0 }, 1.5) >= 0.05);
+});
+
+// judges body times against the history the way a test without a baseline is
+class HistoryProbe : public dtest::PerformanceTest {
+public:
+    HistoryProbe() : PerformanceTest("performance-test", "history-probe") { }
+
+    Status run(double time) {
+        _bodyTime = time;
+        _status = Status::PASS;
+        _errors.clear();
+        _checkHistory();
+        return _status;
+    }
+};
+
+unit("performance-test", "history")
+.ignoreMemoryLeak()
+.body([] {
+    char path[] = "/tmp/dtest-history-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    {
+        std::ofstream out(path);
+        for (int i = 0; i < 10; ++i) {
+            out << "performance-test::history-probe\t0\t" << 1000000 + (i % 3) * 10000 << "\n";
+        }
+    }
+    dtest::History::open(path);
+
+    HistoryProbe probe;
+    assert(probe.run(1010000) == Status::PASS);
+
+    // a lasting regression keeps failing, rather than becoming a regime of
+    // its own after a few runs
+    for (int i = 0; i < 10; ++i) assert(probe.run(1500000) == Status::TOO_SLOW);
+
+    std::ifstream in(path);
+    std::string line;
+    size_t lines = 0;
+    while (std::getline(in, line)) ++lines;
+    assert(lines == 11);
+
+    unlink(path);
+});
+
+perf("performance-test", "throughput")
+.samples(15)
+.warmup(2)
+.minItemsPerSecond(1e6)
+.minThroughputAsBaselineRatio(2)
+.body([] {
+    dtest_set_items_processed(1000000);
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
+})
+.baseline([] {
+    dtest_set_items_processed(100000);
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
+});
+
+perf("performance-test", "throughput-no-baseline")
+.expect(Status::FAIL)
+.minThroughputAsBaselineRatio(2)
+.body([] {
+    dtest_set_items_processed(1000);
+    for (int i = 0; i < 1000; ++i) dtest_do_not_optimize(i);
+});
+
+perf("performance-test", "throughput-too-slow")
+.samples(5)
+.expect(Status::TOO_SLOW)
+.minThroughputAsBaselineRatio(2)
+.onInit([] {
+    dtest_set_bytes_processed(1 << 20);
+})
+.body([] {
+    for (int i = 0; i < 2000000; ++i) dtest_do_not_optimize(i);
+})
+.baseline([] {
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
+});
+
+perf("performance-test", "latency")
+.latency(1000)
+.p99LessThanMicros(10000)
+.body([] {
+    for (int i = 0; i < 1000; ++i) dtest_do_not_optimize(i);
+});
+
+perf("performance-test", "latency-time-op")
+.expect(Status::TOO_SLOW)
+.p50LessThanMicros(1000)
+.p99LessThanMicros(1000)
+.body([] {
+    for (int i = 0; i < 100; ++i) {
+        dtest_time_op([] {
+            int n = dtest_random() < 0.9 ? 10000 : 10000000;
+            for (int j = 0; j < n; ++j) dtest_do_not_optimize(j);
+        });
+    }
+});
+
+perf("performance-test", "latency-no-operations")
+.expect(Status::FAIL)
+.latency()
+.body([] { });
+
+static volatile int counter = 0;
+
+perf("performance-test", "nanoseconds")
+.samples(15)
+.performanceMarginNanos(0)
+.body([] {
+    counter = counter + 1;
+})
+.baseline([] {
+    for (int i = 0; i < 8; ++i) counter = counter + 1;
+});
+
+perf("performance-test", "threads")
+.threads({ 1, 2 })
+.samples(5)
+.warmup(1)
+.maxAllocationsPerIteration(0)
+.onInit([] {
+    dtest_set_items_processed(1000000);
+})
+.body([] {
+    assert(dtest_thread_index() < 2);
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
+});
+
+static std::mutex serialized;
+
+// a speedup cannot be required of more threads than CPUs
+perf("performance-test", "threads-serialized")
+.threads({ 1, 2 })
+.samples(5)
+.warmup(1)
+.minSpeedup(2, 1.5)
+.expect(dtest::currentCpus().size() >= 2 ? Status::TOO_SLOW : Status::FAIL)
+.body([] {
+    std::lock_guard<std::mutex> lock(serialized);
+    for (int i = 0; i < 1000000; ++i) dtest_do_not_optimize(i);
+});
+
+perf("performance-test", "threads-too-few")
+.threads({ 1, 2 })
+.samples(3)
+.minSpeedup(2, 1.5)
+.expect(Status::FAIL)
+.body([] {
+    for (int i = 0; i < 1000; ++i) dtest_do_not_optimize(i);
+});
+
+// a performance test run from within another test, which returns its report
+class Probe : public dtest::PerformanceTest {
+public:
+    Probe(const std::string &name) : PerformanceTest("performance-test", name) { }
+
+    // dtest_set_items_processed() sets those of the test being run by dtest,
+    // which the probe is not
+    void setItemsProcessed(uint64_t n) {
+        _itemsProcessed = n;
+    }
+
+    std::string run() {
+        _driverRun();
+        std::stringstream s;
+        _report(true, s);
+        return s.str();
+    }
+};
+
+// the sandbox cannot be entered again from within a test, so probes run in a
+// process of their own, outside of it
+static bool runOutsideSandbox(const std::function<bool()> &check) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        dtest::sandbox().exitAll();
+        _exit(check() ? 0 : 1);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+unit("performance-test", "threads-throughput")
+.ignoreMemoryLeak()
+.body([] {
+    assert(runOutsideSandbox([] {
+        Probe probe("threads-probe");
+        probe.threads({ 1, 2 })
+            .samples(3)
+            .onInit([&probe] {
+                probe.setItemsProcessed(1000);
+            })
+            .body([] {
+                for (int i = 0; i < 1000; ++i) dtest_do_not_optimize(i);
+            });
+
+        return probe.run().find("\"throughput\": {") != std::string::npos;
+    }));
+});
+
+unit("performance-test", "threads-allocations")
+.ignoreMemoryLeak()
+.body([] {
+    assert(runOutsideSandbox([] {
+        Probe probe("threads-allocations-probe");
+        probe.threads({ 1, 2 })
+            .samples(3)
+            .warmup(1)
+            .body([] {
+                delete new int;
+            });
+
+        auto report = probe.run();
+        report.erase(
+            std::remove_if(report.begin(), report.end(), [] (char c) { return std::isspace(c); }),
+            report.end()
+        );
+        return report.find("\"allocations\":{\"body\":{\"per_run\":1,\"bytes_per_run\":4}") != std::string::npos;
+    }));
+});
+
+unit("performance-test", "threads-latency")
+.ignoreMemoryLeak()
+.body([] {
+    assert(runOutsideSandbox([] {
+        Probe probe("threads-latency-probe");
+        probe.threads({ 1, 2 })
+            .samples(3)
+            .warmup(1)
+            .body([] {
+                for (int i = 0; i < 10; ++i) {
+                    dtest_time_op([] {
+                        for (int j = 0; j < 100; ++j) dtest_do_not_optimize(j);
+                    });
+                }
+            });
+
+        // warmup runs are not recorded
+        auto report = probe.run();
+        return report.find("\"operations\": 30,") != std::string::npos
+            && report.find("\"operations\": 60,") != std::string::npos;
+    }));
+});
+
+static void hotLoop() {
+    for (int i = 0; i < 100000000; ++i) dtest_do_not_optimize(i);
+}
+
+unit("performance-test", "profile")
+.ignoreMemoryLeak()
+.body([] {
+    assert(runOutsideSandbox([] {
+        Probe probe("profile-probe");
+        probe.profile()
+            .body([] {
+                hotLoop();
+            });
+        probe.run();
+
+        std::ifstream in("dtest.profile/performance-test::profile-probe.folded");
+        std::stringstream folded;
+        folded << in.rdbuf();
+        unlink("dtest.profile/performance-test::profile-probe.folded");
+
+        auto hot = dtest::hotFrames(folded.str(), 1);
+        return ! hot.empty() && hot[0].frame == "hotLoop()";
+    }));
+});
+
+perf("performance-test", "allocations")
+.samples(15)
+.warmup(2)
+.performanceMarginAsBaselineRatio(0.5)
+.maxAllocationsPerIteration(0)
+.body([] {
+    for (int i = 0; i < 1000; ++i) dtest_do_not_optimize(i);
+})
+.baseline([] {
+    for (int i = 0; i < 800000; ++i) dtest_do_not_optimize(i);
+});
+
+perf("performance-test", "allocations-too-many")
+.samples(15)
+.warmup(2)
+.performanceMarginAsBaselineRatio(0.5)
+.maxAllocationsPerIteration(0)
+.expect(Status::TOO_SLOW)
+.body([] {
+    int *p = new int;
+    dtest_do_not_optimize(p);
+    delete p;
+})
+.baseline([] {
+    for (int i = 0; i < 800000; ++i) dtest_do_not_optimize(i);
+});
+
+unit("performance-test", "allocation-counts")
+.ignoreMemoryLeak()
+.body([] {
+    assert(runOutsideSandbox([] {
+        Probe probe("allocations-probe");
+        probe.samples(5)
+            .body([] {
+                int *i = new int;
+                double *d = new double;
+                dtest_do_not_optimize(i);
+                dtest_do_not_optimize(d);
+                delete i;
+                delete d;
+            })
+            .baseline([] {
+                int *i = new int;
+                dtest_do_not_optimize(i);
+                delete i;
+            });
+
+        auto report = probe.run();
+        report.erase(std::remove_if(report.begin(), report.end(), ::isspace), report.end());
+
+        return report.find(
+            "\"allocations\":{"
+                "\"body\":{\"per_run\":2,\"bytes_per_run\":12},"
+                "\"baseline\":{\"per_run\":1,\"bytes_per_run\":4}"
+            "}"
+        ) != std::string::npos;
+    }));
+});
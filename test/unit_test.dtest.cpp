@@ -8,6 +8,7 @@
 #include <thread>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <sched.h>
 
 unit("root-test")
 .body([] {
@@ -342,3 +343,18 @@ unit("unit-test", "memory-leak-in-onInit-2")
 })
 .body([] {
 });
+
+unit("unit-test", "cpus")
+.cpus({ 0 })
+.body([] {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    assert(CPU_COUNT(&set) == 1 && CPU_ISSET(0, &set));
+});
+
+unit("unit-test", "invalid-cpus")
+.expect(Status::FAIL)
+.cpus({ -1 })
+.body([] {
+});